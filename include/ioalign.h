@@ -25,6 +25,40 @@
 #include <vector>
 #include <string>
 #include <ios>
+#include <streambuf>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <cerrno>
+#define IO_ALIGN_POSIX 1
+#endif
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <thread>
+#include <chrono>
+#else
+#include <ctime>
+#endif
+
+#if !defined(IO_ALIGN_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#define IO_ALIGN_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if !defined(IO_ALIGN_NO_TO_CHARS) && __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#include <limits>
+#include <type_traits>
+#endif
+#endif
+#if defined(__cpp_lib_to_chars)
+#define IO_ALIGN_TO_CHARS 1
+#endif
 
 /// Namespace for io::align.
 namespace io
@@ -33,10 +67,24 @@ namespace io
     template<typename OStream>
     class basic_align;
 
+    /// Alignment state for tables with a number of columns fixed at compile time.
+    template<typename OStream, unsigned N>
+    class basic_static_align;
+
+#if __cplusplus >= 201103L
+    /// Alignment state shared by threads that print to the same stream.
+    template<typename OStream>
+    class basic_shared_align;
+#endif
+
     /// Output proxy: interfaces between basic_align and the output stream.
     template<typename Align>
     class basic_align_proxy;
 
+    /// Stream buffer that counts the characters passed to another buffer.
+    template<typename Char, typename Traits>
+    class ocounter;
+
     /** @brief Manipulator that calls basic_align_proxy::hline.
      *
      * For example:
@@ -132,6 +180,12 @@ namespace io
     /// @cond hidden
     template<typename Char, bool heads>
     class raw_;
+
+    namespace detail
+    {
+        // States of the CSV parser between characters.
+        enum csv_state { csv_plain, csv_quoted, csv_closed };
+    }
     /// @endcond
 
     /** @brief Manipulator object to help call basic_align_proxy::raw.
@@ -155,6 +209,18 @@ namespace io
     raw_<Char, false>
     raw(const std::basic_string<Char, Traits>& s);
 
+    /** @brief Manipulator object to help call basic_align_proxy::raw.
+     *
+     * For example:
+     *
+     *     proxy << io::raw(buf, len);
+     *
+     * The characters need not be nul-terminated.
+     */
+    template<typename Char>
+    raw_<Char, false>
+    raw(const Char *s, std::size_t n);
+
     /** @brief Manipulator object to help call basic_align_proxy::rawheads.
      *
      * For example:
@@ -176,6 +242,171 @@ namespace io
     raw_<Char, true>
     rawheads(const std::basic_string<Char, Traits>& s);
 
+    /// How the width of cell text is counted; see basic_align_proxy::setwidth.
+    enum width_flags
+    {
+        width_bytes = 0, ///< One column per character.
+        width_utf8  = 1, ///< Terminal display width of UTF-8 text.
+        width_ansi  = 2  ///< No width for ANSI escape sequences.
+    };
+
+    /// How cells wider than their column's maximum width are printed; see basic_align_proxy::setoverflow.
+    enum cap_mode
+    {
+        cap_overflow, ///< Print the whole cell, past the end of the column.
+        cap_truncate, ///< Cut the cell at the maximum width.
+        cap_elide     ///< Cut the cell and end it with a marker.
+    };
+
+    /// When the proxy flushes the attached stream; see basic_align_proxy::setflush.
+    enum flush_policy
+    {
+        flush_never, ///< Only when the stream is flushed explicitly.
+        flush_cell,  ///< After each cell.
+        flush_row,   ///< After each row.
+        flush_rows,  ///< After every N rows.
+        flush_bytes, ///< After the row in which N characters were written since the last flush.
+        flush_delay, ///< Once a row has waited N milliseconds; see basic_align_proxy::pollflush.
+        flush_auto   ///< After each row on a terminal, otherwise never.
+    };
+
+    /** @brief Counters kept by basic_align_proxy; see basic_align_proxy::setstats.
+     *
+     * The counters start at zero and are only added to, so that one
+     * object can collect the counts of several proxies used in turn.
+     */
+    struct align_stats
+    {
+        unsigned long long rows;       ///< Rows printed, including titles and rules.
+        unsigned long long cells;      ///< Cells printed, including titles.
+        unsigned long long payload;    ///< Characters of cell text.
+        unsigned long long padding;    ///< Fill characters.
+        unsigned long long rule_chars; ///< Characters of horizontal rules.
+        unsigned long long separators; ///< Separator and newline characters.
+        unsigned long long flushes;    ///< Flushes made by the flush policy.
+        unsigned long long heads;      ///< Title rows printed.
+        unsigned long long rules;      ///< Horizontal rules printed.
+        std::vector<unsigned long long> widened; ///< Times each column was widened.
+
+        align_stats()
+            : rows(0), cells(0), payload(0), padding(0), rule_chars(0), separators(0),
+              flushes(0), heads(0), rules(0), widened()
+        {}
+
+        /// Add the counts of another object.
+        align_stats& operator+=(const align_stats& o)
+        {
+            rows += o.rows;
+            cells += o.cells;
+            payload += o.payload;
+            padding += o.padding;
+            rule_chars += o.rule_chars;
+            separators += o.separators;
+            flushes += o.flushes;
+            heads += o.heads;
+            rules += o.rules;
+            if (widened.size() < o.widened.size())
+                widened.resize(o.widened.size());
+            for (std::size_t i = 0; i < o.widened.size(); ++i)
+                widened[i] += o.widened[i];
+            return *this;
+        }
+    };
+
+    /** @brief Compute the column widths needed by raw input.
+     * @param s The first character of the raw input.
+     * @param n The number of characters in the raw input.
+     * @param tab The column separator in the raw input.
+     * @param widths The column widths, widened as needed.
+     * @param flags How to count the width of the text; see width_flags.
+     *
+     * The input is split into rows and columns as
+     * basic_align_proxy::raw would, but nothing is printed. The
+     * result can be merged with other widths and passed to
+     * basic_align::widen before formatting the same input.
+     */
+    template<typename Char>
+    void measure(const Char* s, std::size_t n, Char tab, std::vector<int>& widths,
+                 unsigned flags = width_bytes);
+
+    /** @brief Compute the column widths needed by raw input split on a string.
+     *
+     * Like measure() above, with a column separator string as
+     * accepted by basic_align_proxy::setrawsep.
+     */
+    template<typename Char>
+    void measure(const Char* s, std::size_t n, const Char* sep, std::vector<int>& widths,
+                 unsigned flags = width_bytes);
+
+    /** @brief Compute the column widths needed by CSV input.
+     *
+     * Like measure() above, with the input split and unquoted as
+     * basic_align_proxy::raw_csv would with the separator sep. The
+     * input starts outside quotes.
+     */
+    template<typename Char>
+    void measure_csv(const Char* s, std::size_t n, Char sep, std::vector<int>& widths,
+                     unsigned flags = width_bytes);
+
+    /** @brief What raw input prints, apart from the padding that depends on the final column widths.
+     *
+     * Filled by measure_extent() while the column widths are not
+     * known yet; size() then gives the number of characters that
+     * basic_align_proxy::raw, followed by io::endr, prints for the
+     * same input once they are.
+     */
+    struct raw_extent
+    {
+        std::vector<int> widths;                ///< Column widths needed, as computed by measure().
+        std::vector<unsigned long long> padded; ///< Cells followed by padding and a separator, per column.
+        std::vector<unsigned long long> filled; ///< Total width of these cells, per column.
+        unsigned long long chars;               ///< Characters of cell text, separators and newlines.
+
+        raw_extent() : widths(), padded(), filled(), chars(0) {}
+
+        /// The number of characters printed with the column widths of a table.
+        template<typename Align>
+        unsigned long long size(const Align& a) const
+        {
+            unsigned long long n = chars;
+            for (std::size_t i = 0; i < padded.size(); ++i)
+                n += padded[i] * a.width(i) - filled[i];
+            return n;
+        }
+    };
+
+    /** @brief Compute the column widths needed by raw input and the extent of its output.
+     * @param s The first character of the raw input.
+     * @param n The number of characters in the raw input.
+     * @param sep The column separator, as accepted by basic_align_proxy::setrawsep.
+     * @param a The table whose column width limits apply.
+     * @param flags How to count the width of the text; see width_flags.
+     * @param mode How cells wider than their limit are printed; see basic_align_proxy::setoverflow.
+     * @param marker With io::cap_elide, the text that ends a cut cell, or null for "...".
+     * @param x The extent, added to.
+     *
+     * Like measure(), and in the same pass, counts what a proxy
+     * set up with the same separator, flags and overflow mode prints
+     * for the input, given the limits of `a`. Once the widths of all
+     * the input are merged into `a`, x.size(a) is the exact size of
+     * the output.
+     */
+    template<typename Char, typename Align>
+    void measure_extent(const Char* s, std::size_t n, const Char* sep, const Align& a,
+                        unsigned flags, cap_mode mode, const Char* marker, raw_extent& x);
+
+    /** @brief Manipulator object to help call basic_align_proxy::rawheads.
+     *
+     * For example:
+     *
+     *     proxy << io::rawheads(buf, len);
+     *
+     * The characters need not be nul-terminated.
+     */
+    template<typename Char>
+    raw_<Char, true>
+    rawheads(const Char *s, std::size_t n);
+
     template<typename Align>
     class basic_align_proxy {
     public:
@@ -184,6 +415,7 @@ namespace io
         typedef typename stream_type::pos_type  pos_type;
         typedef typename Align::string_type     string_type;
         typedef typename string_type::size_type size_type;
+        typedef typename Align::traits_type     traits_type;
 
         /** @brief Parse a C string and interpret tabs and newlines as table control.
          * @param cstr The nul-terminated C string to parse.
@@ -199,6 +431,40 @@ namespace io
         void
         raw(const char_type* cstr);
 
+        /** @brief Parse a character span and interpret tabs and newlines as table control.
+         * @param s The first character of the span.
+         * @param n The number of characters in the span.
+         *
+         * The span is not copied and need not be nul-terminated.
+         */
+        void
+        raw(const char_type* s, size_type n);
+
+        /** @brief Parse CSV text and interpret separators and newlines as table control.
+         * @param s The first character of the text.
+         * @param n The number of characters in the text.
+         *
+         * Fields may be quoted as in RFC 4180: separators and
+         * newlines within quotes belong to the cell, and two quotes
+         * within quotes stand for one. The quotes are not printed,
+         * and line breaks within quotes are printed as spaces. A CR
+         * before a newline is dropped, so CR LF ends a row too, and
+         * is one line break within quotes. A quoted field or a CR LF
+         * may continue in the next call; see inquotes().
+         */
+        void
+        raw_csv(const char_type* s, size_type n);
+
+        /// Parse a C string as CSV text, like raw_csv(s, n).
+        void
+        raw_csv(const char_type* cstr);
+
+        /// Set the field separator for raw_csv.
+        void setcsvsep(char_type sep = ',');
+
+        /// Whether the text given to raw_csv so far ends within quotes.
+        bool inquotes() const;
+
         /** @brief Parse a C string for column headers.
          * @param cstr The nul-terminated C string to parse.
          *
@@ -213,6 +479,13 @@ namespace io
         void
         rawheads(const char_type* cstr);
 
+        /** @brief Parse a character span for column headers.
+         * @param s The first character of the span.
+         * @param n The number of characters in the span.
+         */
+        void
+        rawheads(const char_type* s, size_type n);
+
         /** @brief Sets a column header title.
          * @param cstr The C string to use.
          * @param min_width The minimum column width, if desired.
@@ -251,7 +524,16 @@ namespace io
         /// Erase the column headers.
         void resetheads();
 
-        /// Output a value to the attached stream.
+        /** @brief Output a value to the attached stream.
+         *
+         * Where the standard library provides std::to_chars, integers
+         * and floating-point numbers are converted directly into the
+         * output, honoring the base, `uppercase`, precision and
+         * `fixed`/`scientific` flags of the stream. The stream
+         * formats them itself when a field width, `showbase`,
+         * `showpos` or `showpoint` is set, or when the stream does not
+         * use the classic locale.
+         */
         template<typename T>
         basic_align_proxy&
         operator<<(const T& t);
@@ -260,6 +542,43 @@ namespace io
         basic_align_proxy&
         operator<<(const sethead_<char_type>& h);
 
+#if __cplusplus >= 201103L
+        /** @brief Output a whole row of values.
+         *
+         * For example:
+         *
+         *     p.row("total", n, 3.5);
+         *
+         * Is equivalent to:
+         *
+         *     p << "total" << io::tab << n << io::tab << 3.5 << io::endr;
+         *
+         * The cells are formatted one after the other in the proxy,
+         * then the columns are fitted to all of them at once and the
+         * padded row is passed to the stream with a single write,
+         * whether or not setrowbuf is in effect. A row that does not
+         * start at the first column, rows held back by setlookahead
+         * and rows flushed with flush_cell go cell by cell.
+         */
+        template<typename... T>
+        basic_align_proxy&
+        row(const T&... cells);
+
+        /** @brief Set the column titles and print them as a row.
+         *
+         * For example:
+         *
+         *     p.heads_row("name", "size");
+         *
+         * Is equivalent to:
+         *
+         *     p << io::head("name") << io::head("size") << io::endr << io::heads;
+         */
+        template<typename... T>
+        basic_align_proxy&
+        heads_row(const T&... titles);
+#endif
+
         /// Call basic_align_proxy::raw.
         basic_align_proxy&
         operator<<(const raw_<char_type, false>& h);
@@ -271,6 +590,9 @@ namespace io
         /// Destroy the proxy and release the attached stream.
         ~basic_align_proxy();
 
+        /// Take over the stream attached to another proxy.
+        basic_align_proxy(const basic_align_proxy& other);
+
         /// Set the column fill character.
         void setfill(char_type fill = ' ');
         /// Set the column separator character.
@@ -279,21 +601,177 @@ namespace io
         void setrule(char_type rule = '-');
         /// Set the column separator character on raw input.
         void setrawsep(char_type tab = '\t');
+        /** @brief Set the column separator on raw input to a string.
+         * @param sep The separator, which must not contain a newline.
+         *
+         * With a separator of several characters, such as " | " or
+         * "::", cells are split where the whole string occurs. With
+         * an empty separator, cells are split on runs of spaces and
+         * tabs, and blanks at the start and end of each row are
+         * ignored, like `column -t` does. Either way, a separator is
+         * only recognized within the text passed to one call.
+         */
+        void setrawsep(const char_type* sep);
+
+        /** @brief Choose how the width of cell text is counted.
+         * @param flags A combination of width_flags.
+         *
+         * By default each character counts as one column. With
+         * io::width_utf8, narrow text is decoded as UTF-8 and each
+         * code point counts for its display width on a terminal:
+         * none for combining marks, two for East Asian wide
+         * characters. Wide character streams count code points the
+         * same way. With io::width_ansi, terminal escape sequences
+         * such as colors take no column; they are still written to
+         * the stream. Runs of plain ASCII text are still counted by
+         * their length. Should be called between cells.
+         */
+        void setwidth(unsigned flags);
+
+        /** @brief Choose how cells wider than their column's maximum width are printed.
+         * @param mode One of cap_mode.
+         * @param marker With io::cap_elide, the text that ends a cut cell, or null for "...".
+         *
+         * Maximum widths are set with basic_align::setmaxwidth; a
+         * column never grows past its maximum width. With
+         * io::cap_overflow, the default, a wider cell is printed in
+         * full and pushes the rest of its row to the right. With
+         * io::cap_truncate and io::cap_elide, cells and column titles
+         * are cut to the maximum width instead, which requires the
+         * current row to be collected as with setrowbuf. Escape
+         * sequences in the cut text are kept with io::width_ansi, so
+         * that colors are still reset. Should be called between rows.
+         */
+        void setoverflow(cap_mode mode, const char_type* marker = 0);
+
+        /** @brief Collect each row and write it to the stream at once.
+         * @param on Whether to collect rows.
+         *
+         * When enabled, the cells, padding and separators of the
+         * current row are assembled in a buffer owned by the proxy,
+         * and the complete row is passed to the stream with a single
+         * write when the row ends. The buffer is reused across rows.
+         */
+        void setrowbuf(bool on = true);
+
+        /** @brief Choose when the attached stream is flushed.
+         * @param policy When to flush.
+         * @param n The number of rows, characters or milliseconds
+         * for io::flush_rows, io::flush_bytes and io::flush_delay.
+         * @param fd The file descriptor written to, for io::flush_auto.
+         *
+         * By default the proxy never flushes the stream, which
+         * suits output to files and pipes best. Interactive output
+         * may rather be flushed after each row. With io::flush_auto,
+         * it is if @a fd is a terminal. Rows held back by setrowbuf
+         * or setlookahead are flushed once they reach the stream.
+         */
+        void setflush(flush_policy policy, unsigned long n = 1, int fd = -1);
+
+        /** @brief Flush rows that have waited for the io::flush_delay delay.
+         * @return The milliseconds until the waiting rows are due, or
+         * -1 if no row waits.
+         *
+         * The delay is otherwise only checked when a row ends. A
+         * caller waiting for more rows polls this, at the latest
+         * after the returned time, to bound the delay of the last
+         * rows of a burst.
+         */
+        long pollflush();
+
+        /** @brief Count what the proxy prints.
+         * @param stats The counters to add to, or null to stop counting.
+         *
+         * The counters are updated as rows and cells are completed.
+         * The object must outlive the proxy or a later call to
+         * setstats. Counting costs a test per cell when disabled.
+         */
+        void setstats(align_stats* stats);
+
+        /** @brief Hold rows back to widen columns before they are printed.
+         * @param rows The number of rows to hold, or 0 for no limit.
+         * @param bytes The number of bytes of cell text to hold, or 0 for no limit.
+         *
+         * When either limit is set, completed rows are kept in a
+         * window instead of being printed right away. Each row
+         * entering the window widens the columns, and the oldest row
+         * is printed with the column widths known at that time once
+         * the window exceeds a limit. Memory use is bounded by the
+         * window, not by the table. Call with both limits at zero
+         * to print the held rows and return to immediate output.
+         *
+         * Held rows use the fill, separator and rule characters in
+         * effect when they leave the window. Should be called between
+         * rows.
+         */
+        void setlookahead(unsigned rows, size_type bytes = 0);
+
+        /// Print all rows held in the lookahead window.
+        void drain();
     private:
-        stream_type& os_;
-        Align&       a_;
-        unsigned     col_;
-        pos_type     cursor_;
-        pos_type     last_pos_;
-        bool         at_begin_;
-        std::locale  prev_locale_;
-        char_type    fill_char_;
-        char_type    sep_char_;
-        char_type    rule_char_;
-        char_type    tab_char_;
+        typedef ocounter<char_type, traits_type> counter_type;
+
+        // A row held in the lookahead window.
+        static const unsigned no_rule = unsigned(-1);
+        struct held_row
+        {
+            held_row() : text(), ends(), rule(no_rule) {}
+
+            string_type            text;  // cell contents, back to back
+            std::vector<size_type> ends;  // end of each cell in text
+            unsigned               rule;  // first column of a rule, or no_rule
+        };
+
+        stream_type&   os_;
+        Align&         a_;
+        unsigned       col_;
+        std::streamoff last_pos_;
+        bool           at_begin_;
+        counter_type   counter_;
+        char_type      fill_char_;
+        char_type      sep_char_;
+        char_type      rule_char_;
+        string_type    tab_;
+        char_type      csv_sep_;
+        detail::csv_state csv_state_;
+        bool           csv_cr_;   // whether raw_csv text ended with a CR
+        string_type    csv_cell_; // unquoted text of a cell
+        string_type    fills_;
+        string_type    rules_;
+        bool           rowbuf_;
+        mutable bool   taken_;         // whether a copy took over the stream
+
+        // Width caps.
+        cap_mode       cap_mode_;
+        string_type    marker_;
+        string_type    cut_;      // escape sequences from cut text
+        std::streamoff cell_off_; // character count at the start of the cell
+
+        // Flush policy.
+        flush_policy   flush_;
+        unsigned long  flush_n_;
+        unsigned long  flush_rows_; // rows since the last flush
+        unsigned long long flush_mark_; // characters at the last flush, or time of the first row since
+        align_stats*   stats_;
+
+        // Lookahead state.
+        unsigned               max_rows_;
+        size_type              max_bytes_;
+        std::vector<held_row>  window_;
+        size_type              win_first_;
+        size_type              win_size_;
+        size_type              win_bytes_;
+        std::vector<size_type> cells_;
+        counter_type           emit_;
 
         template<typename O>
         friend class basic_align;
+        template<typename O, unsigned M>
+        friend class basic_static_align;
+#if __cplusplus >= 201103L
+        template<typename O>
+        friend class basic_shared_align;
+#endif
 
         basic_align_proxy(stream_type &os, Align& a,
                           char_type fill_char,
@@ -310,14 +788,120 @@ namespace io
         unsigned
         pre_tab();
 
+        int
+        cell_width();
+
+        unsigned
+        fit_cell(unsigned col, int w);
+
         void
         complete_column();
 
         void
-        complete_row();
+        complete_row(unsigned rule = no_rule);
 
         bool
         at_column_start();
+
+        void
+        start_cell();
+
+        int
+        cap_cell(unsigned col, int w);
+
+        bool
+        buffering() const;
+
+        void
+        parse(const char_type* s, const char_type* e, bool heads);
+
+        void
+        put_csv(const char_type* s, const char_type* e);
+
+        void
+        put_run(counter_type& out, string_type& span, char_type c, unsigned n);
+
+        void
+        put_sep(counter_type& out, char_type c);
+
+        void
+        count_width(unsigned col, int before, int after);
+
+        bool
+        holding() const;
+
+        void
+        maybe_flush();
+
+        void
+        hold_row(unsigned rule);
+
+        void
+        emit_row(const held_row& r, bool newline);
+
+        std::streamoff
+        cursor() const;
+
+        size_type
+        text_width(const char_type* s, size_type n) const;
+
+        void
+        bind();
+
+        template<typename T>
+        void
+        put(const T& t);
+
+#ifdef IO_ALIGN_TO_CHARS
+        void put(int v)                { put_integer(v); }
+        void put(unsigned v)           { put_integer(v); }
+        void put(long v)               { put_integer(v); }
+        void put(unsigned long v)      { put_integer(v); }
+        void put(long long v)          { put_integer(v); }
+        void put(unsigned long long v) { put_integer(v); }
+        void put(float v)              { put_float(v); }
+        void put(double v)             { put_float(v); }
+        void put(long double v)        { put_float(v); }
+
+        bool
+        fast_numbers(std::ios_base::fmtflags f) const;
+
+        template<typename T>
+        void
+        put_integer(T v);
+
+        template<typename T>
+        void
+        put_float(T v);
+
+        void
+        put_number(char* s, char* e, bool upper);
+#endif
+
+#if __cplusplus >= 201103L
+        void put_cells() {}
+
+        template<typename T, typename... Rest>
+        void
+        put_cells(const T& cell, const Rest&... rest);
+
+        void measure_cells(size_type*, int*) {}
+
+        template<typename T, typename... Rest>
+        void
+        measure_cells(size_type* ends, int* widths, const T& cell, const Rest&... rest);
+
+        void
+        pad_cells(size_type start, const size_type* ends, int* widths, unsigned n);
+
+        void set_heads() {}
+
+        template<typename T, typename... Rest>
+        void
+        set_heads(const T& title, const Rest&... rest);
+#endif
+
+        basic_align_proxy& operator=(const basic_align_proxy&);
     };
 
 
@@ -340,520 +924,3956 @@ namespace io
 
         basic_align();
 
+        /// Widen a column to at least `width` characters.
+        void widen(unsigned col, unsigned width);
+
+        /** @brief Widen the first columns to at least the given widths.
+         *
+         * For example, to format a table with its final column widths
+         * from the start:
+         *
+         *     std::vector<int> w;
+         *     io::measure(text, len, '\t', w);
+         *     a.widen(w.begin(), w.end());
+         */
+        template<typename InputIt>
+        void widen(InputIt first, InputIt last);
+
+        /// The current column widths.
+        const std::vector<int>& widths() const;
+
+        /// The number of columns with a known width.
+        unsigned columns() const;
+
+        /// The width of a column, or 0 if unknown.
+        int width(unsigned col) const;
+
+        /** @brief Reserve storage for a number of columns and their titles.
+         * @param columns The largest number of columns expected.
+         * @param head_len The longest column title expected.
+         *
+         * Once the storage is reserved, setting column titles within
+         * these limits does not allocate memory, even after
+         * basic_align_proxy::resetheads or basic_align_proxy::reset.
+         */
+        void reserve(unsigned columns, std::size_t head_len = 0);
+
+        /** @brief Limit the width of every column.
+         * @param width The maximum width, or 0 for no limit.
+         *
+         * Columns with a limit of their own keep it. Cells wider than
+         * their column's limit do not widen it further; see
+         * basic_align_proxy::setoverflow for how they are printed.
+         */
+        void setmaxwidth(unsigned width);
+
+        /** @brief Limit the width of one column.
+         * @param col The column.
+         * @param width The maximum width, or 0 for no limit even if
+         * every column has one.
+         */
+        void setmaxwidth(unsigned col, unsigned width);
+
+        /// Give a column the limit of every column again.
+        void clearmaxwidth(unsigned col);
+
+        /// The maximum width of a column, or 0 if unlimited.
+        int maxwidth(unsigned col) const;
+
     private:
+        // Storage interface used by basic_align_proxy.
+        int fit(unsigned col, int width);
+        void clear_widths();
+        unsigned nheads() const;
+        const string_type& head(unsigned col) const;
+        void set_head(unsigned col, const char_type* s, std::size_t n);
+        void clear_heads();
+
         std::vector<int>         widths_;
+        // Title slots are kept across resets, so that their storage
+        // is reused; only the first nheads_ are in use.
         std::vector<string_type> heads_;
+        std::size_t              nheads_;
+        std::vector<int>         maxwidths_; // per column, -1 for maxwidth_
+        int                      maxwidth_;
+
+        void cap_widths();
 
         template<typename A>
         friend class basic_align_proxy;
     };
 
-    typedef basic_align<std::ostream> align;
-    typedef basic_align_proxy<align> align_proxy;
+    /** @brief Alignment state for tables with a number of columns fixed at compile time.
+     *
+     * Like basic_align, but the widths and titles of the `N` columns
+     * are kept in arrays inside the object: widening a column never
+     * allocates memory, and loops over the columns have a constant
+     * bound. The table always has `N` columns, so io::next wraps
+     * after the last one and rules span all of them. Cells beyond
+     * the last column are printed without padding.
+     *
+     * For tables whose layout is known upfront, the initial widths
+     * can be given to the constructor:
+     *
+     *     static const int w[3] = { 8, 4, 12 };
+     *     io::basic_static_align<std::ostream, 3> a(w);
+     *     io::basic_static_align<std::ostream, 3>::proxy_type p = a.attach(std::cout);
+     *
+     * basic_align_proxy::reset restores these widths.
+     */
+    template<typename OStream, unsigned N>
+    class basic_static_align
+    {
+    public:
+        typedef OStream                                     stream_type;
+        typedef basic_align_proxy<basic_static_align>       proxy_type;
+        typedef typename OStream::char_type                 char_type;
+        typedef typename OStream::traits_type               traits_type;
+        typedef std::basic_string<char_type, traits_type>   string_type;
 
-    /// @cond IMPLEMENTATION
+        proxy_type
+        attach(stream_type& os,
+               char_type fill_char = ' ',
+               char_type sep_char = ' ',
+               char_type rule_char = '-',
+               char_type tab_char = '\t');
 
-    template<typename A>
-    bool basic_align_proxy<A>::at_column_start()
-    {
-        os_.flush();
-        return cursor_ == last_pos_;
-    }
+        basic_static_align();
 
-    template<typename A>
-    void basic_align_proxy<A>::setfill(typename basic_align_proxy<A>::char_type fill_char)
-    {
-        fill_char_ = fill_char;
-    }
+        /// Start with the given column widths.
+        explicit basic_static_align(const int (&widths)[N]);
 
-    template<typename A>
-    void basic_align_proxy<A>::setsep(typename basic_align_proxy<A>::char_type sep_char)
-    {
-        sep_char_ = sep_char;
-    }
+        /// Widen a column to at least `width` characters.
+        void widen(unsigned col, unsigned width);
 
-    template<typename A>
-    void basic_align_proxy<A>::setrule(typename basic_align_proxy<A>::char_type rule_char)
-    {
-        rule_char_ = rule_char;
+        /// Widen the first columns to at least the given widths.
+        template<typename InputIt>
+        void widen(InputIt first, InputIt last);
+
+        /// The number of columns, `N`.
+        unsigned columns() const { return N; }
+
+        /// The width of a column, or 0 beyond the last column.
+        int width(unsigned col) const { return col < N ? widths_[col] : 0; }
+
+        /// Limit the width of every column, or 0 for no limit; see basic_align::setmaxwidth.
+        void setmaxwidth(unsigned width);
+
+        /// Limit the width of one column, or 0 for no limit; see basic_align::setmaxwidth.
+        void setmaxwidth(unsigned col, unsigned width);
+
+        /// Give a column the limit of every column again.
+        void clearmaxwidth(unsigned col);
+
+        /// The maximum width of a column, or 0 if unlimited.
+        int maxwidth(unsigned col) const
+        {
+            return col < N && maxwidths_[col] >= 0 ? maxwidths_[col] : maxwidth_;
+        }
+
+    private:
+        // Storage interface used by basic_align_proxy.
+        int fit(unsigned col, int width);
+        void clear_widths();
+        unsigned nheads() const { return nheads_; }
+        const string_type& head(unsigned col) const { return heads_[col]; }
+        void set_head(unsigned col, const char_type* s, std::size_t n);
+        void clear_heads() { nheads_ = 0; }
+
+        int         initial_[N];
+        int         widths_[N];
+        string_type heads_[N];
+        unsigned    nheads_;
+        int         maxwidths_[N];
+        int         maxwidth_;
+
+        void cap_widths();
+
+        template<typename A>
+        friend class basic_align_proxy;
+    };
+
+#if __cplusplus >= 201103L
+    /** @brief Alignment state shared by threads that print to the same stream.
+     *
+     * Each thread formats its rows with its own writer, which is a
+     * basic_align_proxy. The writers share the column widths, which
+     * only grow and are updated without locks, and publish each
+     * completed row to a queue. Whichever writer finds the output
+     * free then passes the queued rows to the stream, so that rows
+     * are never mixed up and no thread waits for another to format.
+     *
+     * For example:
+     *
+     *     io::shared_align a(std::cout, 8);
+     *
+     *     // In each thread:
+     *     io::shared_align::writer w(a);
+     *     w << name << io::tab << size << io::endr;
+     *
+     * The number of columns with a width is fixed by the constructor;
+     * cells beyond it are printed without padding. As with
+     * basic_align, rows printed before a column widens are not
+     * realigned.
+     *
+     * Column titles are not synchronized: set them before the other
+     * threads start printing, or from one thread only while no other
+     * thread prints them.
+     */
+    template<typename OStream>
+    class basic_shared_align
+    {
+    public:
+        typedef typename OStream::char_type                 char_type;
+        typedef typename OStream::traits_type               traits_type;
+        typedef std::basic_ostream<char_type, traits_type>  stream_type;
+        typedef basic_align_proxy<basic_shared_align>       proxy_type;
+        typedef std::basic_string<char_type, traits_type>   string_type;
+
+        class writer;
+
+        /** @brief Share alignment state for output to a stream.
+         * @param os The stream that receives the rows.
+         * @param columns The largest number of columns to align.
+         * @param ordered Whether rows are published one at a time.
+         * @param queue_size The number of rows or batches that can wait for output.
+         *
+         * If `ordered` is true, each writer publishes its rows as
+         * they are completed, so that the rows appear in the order in
+         * which they were completed across all threads. Otherwise each
+         * writer collects its rows and publishes them in batches of
+         * a few kilobytes, which needs fewer queue operations.
+         */
+        basic_shared_align(OStream& os, unsigned columns,
+                           bool ordered = true, std::size_t queue_size = 256);
+
+        /// Pass the remaining rows to the stream.
+        ~basic_shared_align();
+
+        /// Widen a column to at least `width` characters.
+        void widen(unsigned col, unsigned width);
+
+        /// Widen the first columns to at least the given widths.
+        template<typename InputIt>
+        void widen(InputIt first, InputIt last);
+
+        /// The number of columns with a known width.
+        unsigned columns() const { return ncols_.load(std::memory_order_relaxed); }
+
+        /// The width of a column, or 0 if unknown.
+        int width(unsigned col) const
+        {
+            return col < widths_.size() ? widths_[col].load(std::memory_order_relaxed) : 0;
+        }
+
+        /** @brief Limit the width of every column, or 0 for no limit; see basic_align::setmaxwidth.
+         *
+         * Like the column titles, the limits are not synchronized:
+         * set them before the writers start.
+         */
+        void setmaxwidth(unsigned width);
+
+        /// Limit the width of one column, or 0 for no limit; see basic_align::setmaxwidth.
+        void setmaxwidth(unsigned col, unsigned width);
+
+        /// Give a column the limit of every column again.
+        void clearmaxwidth(unsigned col);
+
+        /// The maximum width of a column, or 0 if unlimited.
+        int maxwidth(unsigned col) const
+        {
+            return col < maxwidths_.size() && maxwidths_[col] >= 0 ? maxwidths_[col] : maxwidth_;
+        }
+
+        /** @brief Pass the published rows to the stream and flush it.
+         *
+         * Waits for the writer passing rows to the stream, if any.
+         */
+        void flush();
+
+    private:
+        basic_shared_align(const basic_shared_align&);
+        basic_shared_align& operator=(const basic_shared_align&);
+
+        // Storage interface used by basic_align_proxy.
+        int fit(unsigned col, int width);
+        void clear_widths();
+        unsigned nheads() const { return nheads_; }
+        const string_type& head(unsigned col) const { return heads_[col]; }
+        void set_head(unsigned col, const char_type* s, std::size_t n);
+        void clear_heads() { nheads_ = 0; }
+
+        // Output queue.
+        bool try_push(string_type& text);
+        void push(string_type& text);
+        bool ready() const;
+        void write_out();
+        void drain();
+
+        struct slot
+        {
+            std::atomic<std::size_t> seq;  // position + 1 once filled
+            string_type              text;
+
+            slot() : seq(0), text() {}
+        };
+
+        class row_sink;
+        struct writer_base;
+
+        OStream&                       os_;
+        bool                           ordered_;
+        std::vector<std::atomic<int> > widths_;
+        std::atomic<unsigned>          ncols_;
+        std::vector<string_type>       heads_;
+        unsigned                       nheads_;
+        std::vector<int>               maxwidths_;
+        int                            maxwidth_;
+
+        void cap_widths();
+
+        std::vector<slot>              slots_;
+        std::size_t                    mask_;
+        std::atomic<std::size_t>       tail_;  // next position to fill
+        std::atomic<std::size_t>       head_;  // next position to write out
+        std::atomic<bool>              busy_;  // whether a thread writes out
+
+        template<typename A>
+        friend class basic_align_proxy;
+    };
+#endif
+
+    typedef basic_align<std::ostream> align;
+    typedef basic_align_proxy<align> align_proxy;
+#if __cplusplus >= 201103L
+    typedef basic_shared_align<std::ostream> shared_align;
+#endif
+
+    /** @brief Stream buffer that appends to a string or vector.
+     *
+     * Output goes straight to the end of a container owned by the
+     * caller, for example a std::string or a std::vector<char>,
+     * without the copy that std::ostringstream::str makes. The
+     * container is not cleared; its size is the output position.
+     *
+     *     std::string out;
+     *     io::string_sink sink(out);
+     *     std::ostream os(&sink);
+     *     io::align_proxy p = a.attach(os);
+     */
+    template<typename Container,
+             typename Traits = std::char_traits<typename Container::value_type> >
+    class basic_container_sink
+        : public std::basic_streambuf<typename Container::value_type, Traits>
+    {
+    public:
+        typedef typename Container::value_type char_type;
+        typedef typename Traits::int_type      int_type;
+
+        explicit basic_container_sink(Container& c) : c_(c) {}
+
+        /// The container that receives the output.
+        Container& container() const { return c_; }
+
+        /// The number of characters in the container.
+        std::size_t size() const { return c_.size(); }
+
+    protected:
+        virtual int_type overflow(int_type c)
+        {
+            if (!Traits::eq_int_type(c, Traits::eof()))
+                c_.push_back(Traits::to_char_type(c));
+            return Traits::not_eof(c);
+        }
+
+        virtual std::streamsize xsputn(const char_type* s, std::streamsize n)
+        {
+            c_.insert(c_.end(), s, s + n);
+            return n;
+        }
+
+    private:
+        basic_container_sink(const basic_container_sink&);
+        basic_container_sink& operator=(const basic_container_sink&);
+
+        Container& c_;
+    };
+
+    /** @brief Stream buffer that writes into a fixed array.
+     *
+     * The characters are written directly into a buffer provided by
+     * the caller. Once it is full, further characters are dropped
+     * and the stream reports a failure.
+     *
+     *     char buf[4096];
+     *     io::array_sink sink(buf, sizeof buf);
+     *     std::ostream os(&sink);
+     */
+    template<typename Char, typename Traits = std::char_traits<Char> >
+    class basic_array_sink : public std::basic_streambuf<Char, Traits>
+    {
+    public:
+        typedef typename Traits::int_type int_type;
+
+        basic_array_sink(Char* buf, std::size_t size) : overflowed_(false)
+        {
+            this->setp(buf, buf + size);
+        }
+
+        /// The start of the buffer.
+        Char* data() const { return this->pbase(); }
+
+        /// The number of characters written.
+        std::size_t size() const { return this->pptr() - this->pbase(); }
+
+        /// Whether characters were dropped because the buffer was full.
+        bool overflowed() const { return overflowed_; }
+
+        /// Start again at the beginning of the buffer.
+        void clear()
+        {
+            this->setp(this->pbase(), this->epptr());
+            overflowed_ = false;
+        }
+
+    protected:
+        virtual int_type overflow(int_type c)
+        {
+            if (Traits::eq_int_type(c, Traits::eof()))
+                return Traits::not_eof(c);
+            overflowed_ = true;
+            return Traits::eof();
+        }
+
+        virtual std::streamsize xsputn(const Char* s, std::streamsize n)
+        {
+            std::streamsize room = this->epptr() - this->pptr();
+            if (n > room)
+            {
+                overflowed_ = true;
+                n = room;
+            }
+            Traits::copy(this->pptr(), s, n);
+            this->pbump(n);
+            return n;
+        }
+
+    private:
+        basic_array_sink(const basic_array_sink&);
+        basic_array_sink& operator=(const basic_array_sink&);
+
+        bool overflowed_;
+    };
+
+    /** @brief Stream buffer that writes to a C stdio stream.
+     *
+     * The characters are passed to the FILE without further
+     * buffering; flushing the stream flushes the FILE.
+     */
+    class file_sink : public std::streambuf
+    {
+    public:
+        explicit file_sink(std::FILE* f) : f_(f), count_(0) {}
+
+        /// The number of characters written.
+        std::streamoff count() const { return count_; }
+
+    protected:
+        virtual int_type overflow(int_type c)
+        {
+            if (traits_type::eq_int_type(c, traits_type::eof()))
+                return traits_type::not_eof(c);
+            if (std::putc(c, f_) == EOF)
+                return traits_type::eof();
+            ++count_;
+            return c;
+        }
+
+        virtual std::streamsize xsputn(const char* s, std::streamsize n)
+        {
+            std::streamsize r = std::fwrite(s, 1, n, f_);
+            count_ += r;
+            return r;
+        }
+
+        virtual int sync()
+        {
+            return std::fflush(f_) == 0 ? 0 : -1;
+        }
+
+    private:
+        file_sink(const file_sink&);
+        file_sink& operator=(const file_sink&);
+
+        std::FILE*     f_;
+        std::streamoff count_;
+    };
+
+#ifdef IO_ALIGN_POSIX
+    /** @brief Stream buffer that writes to a POSIX file descriptor.
+     *
+     * The characters are collected in a buffer of the given size
+     * and written with write() when it is full, when the stream is
+     * flushed and when the sink is destroyed. The descriptor is not
+     * closed.
+     */
+    class fd_sink : public std::streambuf
+    {
+    public:
+        explicit fd_sink(int fd, std::size_t size = 1 << 16)
+            : fd_(fd), buf_(size ? size : 1), written_(0), failed_(false)
+        {
+            setp(&buf_[0], &buf_[0] + buf_.size());
+        }
+
+        ~fd_sink() { write_out(); }
+
+        /// The number of characters written, including buffered ones.
+        std::streamoff count() const { return written_ + (pptr() - pbase()); }
+
+        /// Whether a write failed.
+        bool failed() const { return failed_; }
+
+    protected:
+        virtual int_type overflow(int_type c)
+        {
+            if (!write_out())
+                return traits_type::eof();
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        virtual std::streamsize xsputn(const char* s, std::streamsize n)
+        {
+            // Large writes bypass the buffer.
+            if (n >= (std::streamsize)buf_.size())
+            {
+                if (!write_out() || !write_all(s, n))
+                    return 0;
+                written_ += n;
+                return n;
+            }
+            if (n > epptr() - pptr() && !write_out())
+                return 0;
+            traits_type::copy(pptr(), s, n);
+            pbump(n);
+            return n;
+        }
+
+        virtual int sync()
+        {
+            return write_out() ? 0 : -1;
+        }
+
+    private:
+        fd_sink(const fd_sink&);
+        fd_sink& operator=(const fd_sink&);
+
+        bool write_all(const char* s, std::size_t n)
+        {
+            while (!failed_ && n > 0)
+            {
+                ssize_t r = ::write(fd_, s, n);
+                if (r < 0 && errno == EINTR)
+                    continue;
+                if (r <= 0)
+                    failed_ = true;
+                else
+                {
+                    s += r;
+                    n -= r;
+                }
+            }
+            return !failed_;
+        }
+
+        bool write_out()
+        {
+            std::size_t n = pptr() - pbase();
+            bool ok = write_all(pbase(), n);
+            written_ += n;
+            setp(&buf_[0], &buf_[0] + buf_.size());
+            return ok;
+        }
+
+        int               fd_;
+        std::vector<char> buf_;
+        std::streamoff    written_;
+        bool              failed_;
+    };
+#endif
+
+    typedef basic_container_sink<std::string> string_sink;
+    typedef basic_array_sink<char> array_sink;
+
+    /// @cond IMPLEMENTATION
+
+    namespace detail
+    {
+        // Find the first occurrence of a or b in [p, e), or e if none.
+        template<typename Char>
+        inline const Char*
+        find_either(const Char* p, const Char* e, Char a, Char b)
+        {
+            for (; p != e; ++p)
+                if (*p == a || *p == b)
+                    break;
+            return p;
+        }
+
+#ifdef IO_ALIGN_X86_SIMD
+        inline const char*
+        find_either_sse2(const char* p, const char* e, char a, char b)
+        {
+            const __m128i va = _mm_set1_epi8(a);
+            const __m128i vb = _mm_set1_epi8(b);
+            for (; e - p >= 16; p += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)p);
+                int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+                                                       _mm_cmpeq_epi8(x, vb)));
+                if (m)
+                    return p + __builtin_ctz(m);
+            }
+            return find_either<char>(p, e, a, b);
+        }
+
+        __attribute__((target("avx2")))
+        inline const char*
+        find_either_avx2(const char* p, const char* e, char a, char b)
+        {
+            const __m256i va = _mm256_set1_epi8(a);
+            const __m256i vb = _mm256_set1_epi8(b);
+            for (; e - p >= 32; p += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)p);
+                unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va),
+                                                                  _mm256_cmpeq_epi8(x, vb)));
+                if (m)
+                    return p + __builtin_ctz(m);
+            }
+            return find_either_sse2(p, e, a, b);
+        }
+
+        typedef const char* (*find_either_fn)(const char*, const char*, char, char);
+
+        inline find_either_fn
+        select_find_either()
+        {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return &find_either_avx2;
+            return &find_either_sse2;
+        }
+
+        // Narrow characters are scanned 16 or 32 at a time, depending
+        // on what the CPU supports.
+        inline const char*
+        find_either(const char* p, const char* e, char a, char b)
+        {
+            static const find_either_fn fn = select_find_either();
+            return fn(p, e, a, b);
+        }
+#endif
+
+        // Find the first space, tab or newline in [p, e), or e if none.
+        template<typename Char>
+        inline const Char*
+        find_blank(const Char* p, const Char* e)
+        {
+            for (; p != e; ++p)
+                if (*p == ' ' || *p == '\t' || *p == '\n')
+                    break;
+            return p;
+        }
+
+        // Find the first newline or occurrence of the n >= 2
+        // characters sep in [p, e), or e if none. sep contains no
+        // newline.
+        template<typename Char>
+        inline const Char*
+        find_sep(const Char* p, const Char* e, const Char* sep, std::size_t n)
+        {
+            for (;; ++p)
+            {
+                p = find_either(p, e, sep[0], Char('\n'));
+                if (p == e || *p == '\n' ||
+                    ((std::size_t)(e - p) >= n && std::equal(sep + 1, sep + n, p + 1)))
+                    return p;
+            }
+        }
+
+#ifdef IO_ALIGN_X86_SIMD
+        inline const char*
+        find_blank_sse2(const char* p, const char* e)
+        {
+            const __m128i vs = _mm_set1_epi8(' ');
+            const __m128i vt = _mm_set1_epi8('\t');
+            const __m128i vn = _mm_set1_epi8('\n');
+            for (; e - p >= 16; p += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)p);
+                int m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, vs),
+                                                                    _mm_cmpeq_epi8(x, vt)),
+                                                       _mm_cmpeq_epi8(x, vn)));
+                if (m)
+                    return p + __builtin_ctz(m);
+            }
+            return find_blank<char>(p, e);
+        }
+
+        __attribute__((target("avx2")))
+        inline const char*
+        find_blank_avx2(const char* p, const char* e)
+        {
+            const __m256i vs = _mm256_set1_epi8(' ');
+            const __m256i vt = _mm256_set1_epi8('\t');
+            const __m256i vn = _mm256_set1_epi8('\n');
+            for (; e - p >= 32; p += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)p);
+                unsigned m = _mm256_movemask_epi8(
+                    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, vs),
+                                                    _mm256_cmpeq_epi8(x, vt)),
+                                    _mm256_cmpeq_epi8(x, vn)));
+                if (m)
+                    return p + __builtin_ctz(m);
+            }
+            return find_blank_sse2(p, e);
+        }
+
+        // Candidate positions are those where both the first and the
+        // last character of the separator match, which rules out
+        // most false starts, such as single spaces for " | ".
+        inline const char*
+        find_sep_sse2(const char* p, const char* e, const char* sep, std::size_t n)
+        {
+            const __m128i vf = _mm_set1_epi8(sep[0]);
+            const __m128i vl = _mm_set1_epi8(sep[n - 1]);
+            const __m128i vn = _mm_set1_epi8('\n');
+            for (; (std::size_t)(e - p) >= 15 + n; p += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)p);
+                __m128i y = _mm_loadu_si128((const __m128i*)(p + n - 1));
+                int m = _mm_movemask_epi8(_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(x, vf),
+                                                                     _mm_cmpeq_epi8(y, vl)),
+                                                       _mm_cmpeq_epi8(x, vn)));
+                for (; m; m &= m - 1)
+                {
+                    const char* q = p + __builtin_ctz(m);
+                    if (*q == '\n' || std::equal(sep + 1, sep + n - 1, q + 1))
+                        return q;
+                }
+            }
+            return find_sep<char>(p, e, sep, n);
+        }
+
+        __attribute__((target("avx2")))
+        inline const char*
+        find_sep_avx2(const char* p, const char* e, const char* sep, std::size_t n)
+        {
+            const __m256i vf = _mm256_set1_epi8(sep[0]);
+            const __m256i vl = _mm256_set1_epi8(sep[n - 1]);
+            const __m256i vn = _mm256_set1_epi8('\n');
+            for (; (std::size_t)(e - p) >= 31 + n; p += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)p);
+                __m256i y = _mm256_loadu_si256((const __m256i*)(p + n - 1));
+                unsigned m = _mm256_movemask_epi8(
+                    _mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(x, vf),
+                                                     _mm256_cmpeq_epi8(y, vl)),
+                                    _mm256_cmpeq_epi8(x, vn)));
+                for (; m; m &= m - 1)
+                {
+                    const char* q = p + __builtin_ctz(m);
+                    if (*q == '\n' || std::equal(sep + 1, sep + n - 1, q + 1))
+                        return q;
+                }
+            }
+            return find_sep_sse2(p, e, sep, n);
+        }
+
+        typedef const char* (*find_blank_fn)(const char*, const char*);
+        typedef const char* (*find_sep_fn)(const char*, const char*, const char*, std::size_t);
+
+        inline find_blank_fn
+        select_find_blank()
+        {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return &find_blank_avx2;
+            return &find_blank_sse2;
+        }
+
+        inline find_sep_fn
+        select_find_sep()
+        {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return &find_sep_avx2;
+            return &find_sep_sse2;
+        }
+
+        inline const char*
+        find_blank(const char* p, const char* e)
+        {
+            static const find_blank_fn fn = select_find_blank();
+            return fn(p, e);
+        }
+
+        inline const char*
+        find_sep(const char* p, const char* e, const char* sep, std::size_t n)
+        {
+            static const find_sep_fn fn = select_find_sep();
+            return fn(p, e, sep, n);
+        }
+#endif
+
+        // Boundaries between cells of raw input.
+        enum raw_boundary { raw_end, raw_tab, raw_row };
+
+        // Splits raw input into cells, on a separator string or, if
+        // the separator is empty, on runs of spaces and tabs.
+        template<typename Char>
+        class raw_splitter
+        {
+        public:
+            raw_splitter(const Char* sep, std::size_t n) : sep_(sep), n_(n) {}
+
+            // Skip what precedes the first cell of a row at p.
+            const Char*
+            start(const Char* p, const Char* e) const
+            {
+                if (n_ == 0)
+                    while (p != e && (*p == ' ' || *p == '\t'))
+                        ++p;
+                return p;
+            }
+
+            // Find the end of the cell at p. Sets end to the end of
+            // its text and p past the boundary, and returns the kind
+            // of boundary. Blanks at the end of a row or of the input
+            // separate nothing.
+            raw_boundary
+            next(const Char*& p, const Char* e, const Char*& end) const
+            {
+                const Char* d;
+                if (n_ == 1)
+                    d = find_either(p, e, sep_[0], Char('\n'));
+                else if (n_ == 0)
+                    d = find_blank(p, e);
+                else
+                    d = find_sep(p, e, sep_, n_);
+                end = d;
+                if (d == e)
+                {
+                    p = e;
+                    return raw_end;
+                }
+                if (*d == '\n')
+                {
+                    p = d + 1;
+                    return raw_row;
+                }
+                if (n_ > 0)
+                {
+                    p = d + n_;
+                    return raw_tab;
+                }
+                for (p = d; p != e && (*p == ' ' || *p == '\t'); ++p)
+                    ;
+                if (p == e)
+                    return raw_end;
+                if (*p == '\n')
+                {
+                    ++p;
+                    return raw_row;
+                }
+                return raw_tab;
+            }
+
+        private:
+            const Char* sep_;
+            std::size_t n_;
+        };
+
+        // Find the first separator or newline outside quotes in
+        // [p, e), or e if none. quoted tells whether p is within
+        // quotes, and is updated to the state at the result.
+        template<typename Char>
+        inline const Char*
+        find_csv(const Char* p, const Char* e, Char sep, bool& quoted)
+        {
+            for (; p != e; ++p)
+            {
+                if (*p == '"')
+                    quoted = !quoted;
+                else if (!quoted && (*p == sep || *p == '\n'))
+                    break;
+            }
+            return p;
+        }
+
+#ifdef IO_ALIGN_X86_SIMD
+        // Each bit of the result is the parity of the bits of m up to
+        // and including its position.
+        inline unsigned
+        prefix_xor(unsigned m)
+        {
+            m ^= m << 1;
+            m ^= m << 2;
+            m ^= m << 4;
+            m ^= m << 8;
+            m ^= m << 16;
+            return m;
+        }
+
+        // A block is scanned without branching on its quotes: the
+        // prefix XOR of the quote positions marks the characters
+        // within quotes, including between doubled quotes, and the
+        // first separator or newline outside them ends the scan.
+        inline const char*
+        find_csv_sse2(const char* p, const char* e, char sep, bool& quoted)
+        {
+            const __m128i vq = _mm_set1_epi8('"');
+            const __m128i vs = _mm_set1_epi8(sep);
+            const __m128i vn = _mm_set1_epi8('\n');
+            unsigned carry = quoted ? ~0u : 0;
+            for (; e - p >= 16; p += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)p);
+                unsigned q = _mm_movemask_epi8(_mm_cmpeq_epi8(x, vq));
+                unsigned s = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, vs),
+                                                            _mm_cmpeq_epi8(x, vn)));
+                unsigned in = prefix_xor(q) ^ carry;
+                unsigned m = s & ~in & 0xffff;
+                if (m)
+                {
+                    quoted = false;
+                    return p + __builtin_ctz(m);
+                }
+                carry = (in & 0x8000) ? ~0u : 0;
+            }
+            quoted = carry != 0;
+            return find_csv<char>(p, e, sep, quoted);
+        }
+
+        __attribute__((target("avx2")))
+        inline const char*
+        find_csv_avx2(const char* p, const char* e, char sep, bool& quoted)
+        {
+            const __m256i vq = _mm256_set1_epi8('"');
+            const __m256i vs = _mm256_set1_epi8(sep);
+            const __m256i vn = _mm256_set1_epi8('\n');
+            unsigned carry = quoted ? ~0u : 0;
+            for (; e - p >= 32; p += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)p);
+                unsigned q = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vq));
+                unsigned s = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, vs),
+                                                                  _mm256_cmpeq_epi8(x, vn)));
+                unsigned in = prefix_xor(q) ^ carry;
+                unsigned m = s & ~in;
+                if (m)
+                {
+                    quoted = false;
+                    return p + __builtin_ctz(m);
+                }
+                carry = (in & 0x80000000u) ? ~0u : 0;
+            }
+            quoted = carry != 0;
+            return find_csv_sse2(p, e, sep, quoted);
+        }
+
+        typedef const char* (*find_csv_fn)(const char*, const char*, char, bool&);
+
+        inline find_csv_fn
+        select_find_csv()
+        {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return &find_csv_avx2;
+            return &find_csv_sse2;
+        }
+
+        inline const char*
+        find_csv(const char* p, const char* e, char sep, bool& quoted)
+        {
+            static const find_csv_fn fn = select_find_csv();
+            return fn(p, e, sep, quoted);
+        }
+#endif
+
+        // Append the text of the CSV characters [p, e) to out,
+        // starting in state st, and return the state after them.
+        // Quotes are removed, doubled quotes within quotes stand for
+        // one, and line breaks within quotes, CR LF included, become
+        // spaces.
+        template<typename Char, typename String>
+        inline csv_state
+        csv_unquote(const Char* p, const Char* e, csv_state st, String& out)
+        {
+            for (; p != e; ++p)
+            {
+                Char c = *p;
+                if (c == '"')
+                {
+                    if (st == csv_closed)
+                        out += c;
+                    st = (st == csv_quoted) ? csv_closed : csv_quoted;
+                    continue;
+                }
+                if (st == csv_quoted)
+                {
+                    if (c == '\r' && p + 1 != e && p[1] == '\n')
+                        continue;
+                    if (c == '\n' || c == '\r')
+                        c = ' ';
+                }
+                else
+                    st = csv_plain;
+                out += c;
+            }
+            return st;
+        }
+
+        // Milliseconds since an arbitrary point in time. Before
+        // C++11, the resolution is one second.
+        inline unsigned long long
+        clock_ms()
+        {
+#if __cplusplus >= 201103L
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+            return (unsigned long long)std::time(0) * 1000;
+#endif
+        }
+
+        // Whether cp is within one of the n sorted ranges r.
+        inline bool
+        in_ranges(unsigned cp, const unsigned (*r)[2], std::size_t n)
+        {
+            if (cp < r[0][0] || cp > r[n - 1][1])
+                return false;
+            std::size_t lo = 0, hi = n;
+            while (lo < hi)
+            {
+                std::size_t mid = (lo + hi) / 2;
+                if (cp > r[mid][1])
+                    lo = mid + 1;
+                else if (cp < r[mid][0])
+                    hi = mid;
+                else
+                    return true;
+            }
+            return false;
+        }
+
+        // Display width of a code point. The ranges are derived from
+        // the Unicode 15.1 character database: combining marks (Mn,
+        // Me), format characters (Cf) and Hangul medial and final
+        // jamo have no width, and the characters listed as East Asian
+        // wide (W) or fullwidth (F) in EastAsianWidth.txt take two
+        // columns. Unassigned code points take one column, except in
+        // the ranges that EastAsianWidth.txt reserves for wide ones.
+        inline unsigned
+        cp_width(unsigned cp)
+        {
+            static const unsigned zero[][2] = {
+            { 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd },
+            { 0x05bf, 0x05bf }, { 0x05c1, 0x05c2 }, { 0x05c4, 0x05c5 },
+            { 0x05c7, 0x05c7 }, { 0x0600, 0x0605 }, { 0x0610, 0x061a },
+            { 0x061c, 0x061c }, { 0x064b, 0x065f }, { 0x0670, 0x0670 },
+            { 0x06d6, 0x06dd }, { 0x06df, 0x06e4 }, { 0x06e7, 0x06e8 },
+            { 0x06ea, 0x06ed }, { 0x070f, 0x070f }, { 0x0711, 0x0711 },
+            { 0x0730, 0x074a }, { 0x07a6, 0x07b0 }, { 0x07eb, 0x07f3 },
+            { 0x07fd, 0x07fd }, { 0x0816, 0x0819 }, { 0x081b, 0x0823 },
+            { 0x0825, 0x0827 }, { 0x0829, 0x082d }, { 0x0859, 0x085b },
+            { 0x0890, 0x0891 }, { 0x0898, 0x089f }, { 0x08ca, 0x0902 },
+            { 0x093a, 0x093a }, { 0x093c, 0x093c }, { 0x0941, 0x0948 },
+            { 0x094d, 0x094d }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 },
+            { 0x0981, 0x0981 }, { 0x09bc, 0x09bc }, { 0x09c1, 0x09c4 },
+            { 0x09cd, 0x09cd }, { 0x09e2, 0x09e3 }, { 0x09fe, 0x09fe },
+            { 0x0a01, 0x0a02 }, { 0x0a3c, 0x0a3c }, { 0x0a41, 0x0a42 },
+            { 0x0a47, 0x0a48 }, { 0x0a4b, 0x0a4d }, { 0x0a51, 0x0a51 },
+            { 0x0a70, 0x0a71 }, { 0x0a75, 0x0a75 }, { 0x0a81, 0x0a82 },
+            { 0x0abc, 0x0abc }, { 0x0ac1, 0x0ac5 }, { 0x0ac7, 0x0ac8 },
+            { 0x0acd, 0x0acd }, { 0x0ae2, 0x0ae3 }, { 0x0afa, 0x0aff },
+            { 0x0b01, 0x0b01 }, { 0x0b3c, 0x0b3c }, { 0x0b3f, 0x0b3f },
+            { 0x0b41, 0x0b44 }, { 0x0b4d, 0x0b4d }, { 0x0b55, 0x0b56 },
+            { 0x0b62, 0x0b63 }, { 0x0b82, 0x0b82 }, { 0x0bc0, 0x0bc0 },
+            { 0x0bcd, 0x0bcd }, { 0x0c00, 0x0c00 }, { 0x0c04, 0x0c04 },
+            { 0x0c3c, 0x0c3c }, { 0x0c3e, 0x0c40 }, { 0x0c46, 0x0c48 },
+            { 0x0c4a, 0x0c4d }, { 0x0c55, 0x0c56 }, { 0x0c62, 0x0c63 },
+            { 0x0c81, 0x0c81 }, { 0x0cbc, 0x0cbc }, { 0x0cbf, 0x0cbf },
+            { 0x0cc6, 0x0cc6 }, { 0x0ccc, 0x0ccd }, { 0x0ce2, 0x0ce3 },
+            { 0x0d00, 0x0d01 }, { 0x0d3b, 0x0d3c }, { 0x0d41, 0x0d44 },
+            { 0x0d4d, 0x0d4d }, { 0x0d62, 0x0d63 }, { 0x0d81, 0x0d81 },
+            { 0x0dca, 0x0dca }, { 0x0dd2, 0x0dd4 }, { 0x0dd6, 0x0dd6 },
+            { 0x0e31, 0x0e31 }, { 0x0e34, 0x0e3a }, { 0x0e47, 0x0e4e },
+            { 0x0eb1, 0x0eb1 }, { 0x0eb4, 0x0ebc }, { 0x0ec8, 0x0ece },
+            { 0x0f18, 0x0f19 }, { 0x0f35, 0x0f35 }, { 0x0f37, 0x0f37 },
+            { 0x0f39, 0x0f39 }, { 0x0f71, 0x0f7e }, { 0x0f80, 0x0f84 },
+            { 0x0f86, 0x0f87 }, { 0x0f8d, 0x0f97 }, { 0x0f99, 0x0fbc },
+            { 0x0fc6, 0x0fc6 }, { 0x102d, 0x1030 }, { 0x1032, 0x1037 },
+            { 0x1039, 0x103a }, { 0x103d, 0x103e }, { 0x1058, 0x1059 },
+            { 0x105e, 0x1060 }, { 0x1071, 0x1074 }, { 0x1082, 0x1082 },
+            { 0x1085, 0x1086 }, { 0x108d, 0x108d }, { 0x109d, 0x109d },
+            { 0x1160, 0x11ff }, { 0x135d, 0x135f }, { 0x1712, 0x1714 },
+            { 0x1732, 0x1733 }, { 0x1752, 0x1753 }, { 0x1772, 0x1773 },
+            { 0x17b4, 0x17b5 }, { 0x17b7, 0x17bd }, { 0x17c6, 0x17c6 },
+            { 0x17c9, 0x17d3 }, { 0x17dd, 0x17dd }, { 0x180b, 0x180f },
+            { 0x1885, 0x1886 }, { 0x18a9, 0x18a9 }, { 0x1920, 0x1922 },
+            { 0x1927, 0x1928 }, { 0x1932, 0x1932 }, { 0x1939, 0x193b },
+            { 0x1a17, 0x1a18 }, { 0x1a1b, 0x1a1b }, { 0x1a56, 0x1a56 },
+            { 0x1a58, 0x1a5e }, { 0x1a60, 0x1a60 }, { 0x1a62, 0x1a62 },
+            { 0x1a65, 0x1a6c }, { 0x1a73, 0x1a7c }, { 0x1a7f, 0x1a7f },
+            { 0x1ab0, 0x1ace }, { 0x1b00, 0x1b03 }, { 0x1b34, 0x1b34 },
+            { 0x1b36, 0x1b3a }, { 0x1b3c, 0x1b3c }, { 0x1b42, 0x1b42 },
+            { 0x1b6b, 0x1b73 }, { 0x1b80, 0x1b81 }, { 0x1ba2, 0x1ba5 },
+            { 0x1ba8, 0x1ba9 }, { 0x1bab, 0x1bad }, { 0x1be6, 0x1be6 },
+            { 0x1be8, 0x1be9 }, { 0x1bed, 0x1bed }, { 0x1bef, 0x1bf1 },
+            { 0x1c2c, 0x1c33 }, { 0x1c36, 0x1c37 }, { 0x1cd0, 0x1cd2 },
+            { 0x1cd4, 0x1ce0 }, { 0x1ce2, 0x1ce8 }, { 0x1ced, 0x1ced },
+            { 0x1cf4, 0x1cf4 }, { 0x1cf8, 0x1cf9 }, { 0x1dc0, 0x1dff },
+            { 0x200b, 0x200f }, { 0x202a, 0x202e }, { 0x2060, 0x2064 },
+            { 0x2066, 0x206f }, { 0x20d0, 0x20f0 }, { 0x2cef, 0x2cf1 },
+            { 0x2d7f, 0x2d7f }, { 0x2de0, 0x2dff }, { 0x302a, 0x302d },
+            { 0x3099, 0x309a }, { 0xa66f, 0xa672 }, { 0xa674, 0xa67d },
+            { 0xa69e, 0xa69f }, { 0xa6f0, 0xa6f1 }, { 0xa802, 0xa802 },
+            { 0xa806, 0xa806 }, { 0xa80b, 0xa80b }, { 0xa825, 0xa826 },
+            { 0xa82c, 0xa82c }, { 0xa8c4, 0xa8c5 }, { 0xa8e0, 0xa8f1 },
+            { 0xa8ff, 0xa8ff }, { 0xa926, 0xa92d }, { 0xa947, 0xa951 },
+            { 0xa980, 0xa982 }, { 0xa9b3, 0xa9b3 }, { 0xa9b6, 0xa9b9 },
+            { 0xa9bc, 0xa9bd }, { 0xa9e5, 0xa9e5 }, { 0xaa29, 0xaa2e },
+            { 0xaa31, 0xaa32 }, { 0xaa35, 0xaa36 }, { 0xaa43, 0xaa43 },
+            { 0xaa4c, 0xaa4c }, { 0xaa7c, 0xaa7c }, { 0xaab0, 0xaab0 },
+            { 0xaab2, 0xaab4 }, { 0xaab7, 0xaab8 }, { 0xaabe, 0xaabf },
+            { 0xaac1, 0xaac1 }, { 0xaaec, 0xaaed }, { 0xaaf6, 0xaaf6 },
+            { 0xabe5, 0xabe5 }, { 0xabe8, 0xabe8 }, { 0xabed, 0xabed },
+            { 0xd7b0, 0xd7c6 }, { 0xd7cb, 0xd7fb }, { 0xfb1e, 0xfb1e },
+            { 0xfe00, 0xfe0f }, { 0xfe20, 0xfe2f }, { 0xfeff, 0xfeff },
+            { 0xfff9, 0xfffb }, { 0x101fd, 0x101fd }, { 0x102e0, 0x102e0 },
+            { 0x10376, 0x1037a }, { 0x10a01, 0x10a03 }, { 0x10a05, 0x10a06 },
+            { 0x10a0c, 0x10a0f }, { 0x10a38, 0x10a3a }, { 0x10a3f, 0x10a3f },
+            { 0x10ae5, 0x10ae6 }, { 0x10d24, 0x10d27 }, { 0x10eab, 0x10eac },
+            { 0x10efd, 0x10eff }, { 0x10f46, 0x10f50 }, { 0x10f82, 0x10f85 },
+            { 0x11001, 0x11001 }, { 0x11038, 0x11046 }, { 0x11070, 0x11070 },
+            { 0x11073, 0x11074 }, { 0x1107f, 0x11081 }, { 0x110b3, 0x110b6 },
+            { 0x110b9, 0x110ba }, { 0x110bd, 0x110bd }, { 0x110c2, 0x110c2 },
+            { 0x110cd, 0x110cd }, { 0x11100, 0x11102 }, { 0x11127, 0x1112b },
+            { 0x1112d, 0x11134 }, { 0x11173, 0x11173 }, { 0x11180, 0x11181 },
+            { 0x111b6, 0x111be }, { 0x111c9, 0x111cc }, { 0x111cf, 0x111cf },
+            { 0x1122f, 0x11231 }, { 0x11234, 0x11234 }, { 0x11236, 0x11237 },
+            { 0x1123e, 0x1123e }, { 0x11241, 0x11241 }, { 0x112df, 0x112df },
+            { 0x112e3, 0x112ea }, { 0x11300, 0x11301 }, { 0x1133b, 0x1133c },
+            { 0x11340, 0x11340 }, { 0x11366, 0x1136c }, { 0x11370, 0x11374 },
+            { 0x11438, 0x1143f }, { 0x11442, 0x11444 }, { 0x11446, 0x11446 },
+            { 0x1145e, 0x1145e }, { 0x114b3, 0x114b8 }, { 0x114ba, 0x114ba },
+            { 0x114bf, 0x114c0 }, { 0x114c2, 0x114c3 }, { 0x115b2, 0x115b5 },
+            { 0x115bc, 0x115bd }, { 0x115bf, 0x115c0 }, { 0x115dc, 0x115dd },
+            { 0x11633, 0x1163a }, { 0x1163d, 0x1163d }, { 0x1163f, 0x11640 },
+            { 0x116ab, 0x116ab }, { 0x116ad, 0x116ad }, { 0x116b0, 0x116b5 },
+            { 0x116b7, 0x116b7 }, { 0x1171d, 0x1171f }, { 0x11722, 0x11725 },
+            { 0x11727, 0x1172b }, { 0x1182f, 0x11837 }, { 0x11839, 0x1183a },
+            { 0x1193b, 0x1193c }, { 0x1193e, 0x1193e }, { 0x11943, 0x11943 },
+            { 0x119d4, 0x119d7 }, { 0x119da, 0x119db }, { 0x119e0, 0x119e0 },
+            { 0x11a01, 0x11a0a }, { 0x11a33, 0x11a38 }, { 0x11a3b, 0x11a3e },
+            { 0x11a47, 0x11a47 }, { 0x11a51, 0x11a56 }, { 0x11a59, 0x11a5b },
+            { 0x11a8a, 0x11a96 }, { 0x11a98, 0x11a99 }, { 0x11c30, 0x11c36 },
+            { 0x11c38, 0x11c3d }, { 0x11c3f, 0x11c3f }, { 0x11c92, 0x11ca7 },
+            { 0x11caa, 0x11cb0 }, { 0x11cb2, 0x11cb3 }, { 0x11cb5, 0x11cb6 },
+            { 0x11d31, 0x11d36 }, { 0x11d3a, 0x11d3a }, { 0x11d3c, 0x11d3d },
+            { 0x11d3f, 0x11d45 }, { 0x11d47, 0x11d47 }, { 0x11d90, 0x11d91 },
+            { 0x11d95, 0x11d95 }, { 0x11d97, 0x11d97 }, { 0x11ef3, 0x11ef4 },
+            { 0x11f00, 0x11f01 }, { 0x11f36, 0x11f3a }, { 0x11f40, 0x11f40 },
+            { 0x11f42, 0x11f42 }, { 0x13430, 0x13440 }, { 0x13447, 0x13455 },
+            { 0x16af0, 0x16af4 }, { 0x16b30, 0x16b36 }, { 0x16f4f, 0x16f4f },
+            { 0x16f8f, 0x16f92 }, { 0x16fe4, 0x16fe4 }, { 0x1bc9d, 0x1bc9e },
+            { 0x1bca0, 0x1bca3 }, { 0x1cf00, 0x1cf2d }, { 0x1cf30, 0x1cf46 },
+            { 0x1d167, 0x1d169 }, { 0x1d173, 0x1d182 }, { 0x1d185, 0x1d18b },
+            { 0x1d1aa, 0x1d1ad }, { 0x1d242, 0x1d244 }, { 0x1da00, 0x1da36 },
+            { 0x1da3b, 0x1da6c }, { 0x1da75, 0x1da75 }, { 0x1da84, 0x1da84 },
+            { 0x1da9b, 0x1da9f }, { 0x1daa1, 0x1daaf }, { 0x1e000, 0x1e006 },
+            { 0x1e008, 0x1e018 }, { 0x1e01b, 0x1e021 }, { 0x1e023, 0x1e024 },
+            { 0x1e026, 0x1e02a }, { 0x1e08f, 0x1e08f }, { 0x1e130, 0x1e136 },
+            { 0x1e2ae, 0x1e2ae }, { 0x1e2ec, 0x1e2ef }, { 0x1e4ec, 0x1e4ef },
+            { 0x1e8d0, 0x1e8d6 }, { 0x1e944, 0x1e94a }, { 0xe0001, 0xe0001 },
+            { 0xe0020, 0xe007f }, { 0xe0100, 0xe01ef }
+            };
+            static const unsigned wide[][2] = {
+            { 0x1100, 0x115f }, { 0x231a, 0x231b }, { 0x2329, 0x232a },
+            { 0x23e9, 0x23ec }, { 0x23f0, 0x23f0 }, { 0x23f3, 0x23f3 },
+            { 0x25fd, 0x25fe }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 },
+            { 0x267f, 0x267f }, { 0x2693, 0x2693 }, { 0x26a1, 0x26a1 },
+            { 0x26aa, 0x26ab }, { 0x26bd, 0x26be }, { 0x26c4, 0x26c5 },
+            { 0x26ce, 0x26ce }, { 0x26d4, 0x26d4 }, { 0x26ea, 0x26ea },
+            { 0x26f2, 0x26f3 }, { 0x26f5, 0x26f5 }, { 0x26fa, 0x26fa },
+            { 0x26fd, 0x26fd }, { 0x2705, 0x2705 }, { 0x270a, 0x270b },
+            { 0x2728, 0x2728 }, { 0x274c, 0x274c }, { 0x274e, 0x274e },
+            { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+            { 0x27b0, 0x27b0 }, { 0x27bf, 0x27bf }, { 0x2b1b, 0x2b1c },
+            { 0x2b50, 0x2b50 }, { 0x2b55, 0x2b55 }, { 0x2e80, 0x2e99 },
+            { 0x2e9b, 0x2ef3 }, { 0x2f00, 0x2fd5 }, { 0x2ff0, 0x303e },
+            { 0x3041, 0x3096 }, { 0x3099, 0x30ff }, { 0x3105, 0x312f },
+            { 0x3131, 0x318e }, { 0x3190, 0x31e3 }, { 0x31ef, 0x321e },
+            { 0x3220, 0x3247 }, { 0x3250, 0x4dbf }, { 0x4e00, 0xa48c },
+            { 0xa490, 0xa4c6 }, { 0xa960, 0xa97c }, { 0xac00, 0xd7a3 },
+            { 0xf900, 0xfaff }, { 0xfe10, 0xfe19 }, { 0xfe30, 0xfe52 },
+            { 0xfe54, 0xfe66 }, { 0xfe68, 0xfe6b }, { 0xff01, 0xff60 },
+            { 0xffe0, 0xffe6 }, { 0x16fe0, 0x16fe4 }, { 0x16ff0, 0x16ff1 },
+            { 0x17000, 0x187f7 }, { 0x18800, 0x18cd5 }, { 0x18d00, 0x18d08 },
+            { 0x1aff0, 0x1aff3 }, { 0x1aff5, 0x1affb }, { 0x1affd, 0x1affe },
+            { 0x1b000, 0x1b122 }, { 0x1b132, 0x1b132 }, { 0x1b150, 0x1b152 },
+            { 0x1b155, 0x1b155 }, { 0x1b164, 0x1b167 }, { 0x1b170, 0x1b2fb },
+            { 0x1f004, 0x1f004 }, { 0x1f0cf, 0x1f0cf }, { 0x1f18e, 0x1f18e },
+            { 0x1f191, 0x1f19a }, { 0x1f200, 0x1f202 }, { 0x1f210, 0x1f23b },
+            { 0x1f240, 0x1f248 }, { 0x1f250, 0x1f251 }, { 0x1f260, 0x1f265 },
+            { 0x1f300, 0x1f320 }, { 0x1f32d, 0x1f335 }, { 0x1f337, 0x1f37c },
+            { 0x1f37e, 0x1f393 }, { 0x1f3a0, 0x1f3ca }, { 0x1f3cf, 0x1f3d3 },
+            { 0x1f3e0, 0x1f3f0 }, { 0x1f3f4, 0x1f3f4 }, { 0x1f3f8, 0x1f43e },
+            { 0x1f440, 0x1f440 }, { 0x1f442, 0x1f4fc }, { 0x1f4ff, 0x1f53d },
+            { 0x1f54b, 0x1f54e }, { 0x1f550, 0x1f567 }, { 0x1f57a, 0x1f57a },
+            { 0x1f595, 0x1f596 }, { 0x1f5a4, 0x1f5a4 }, { 0x1f5fb, 0x1f64f },
+            { 0x1f680, 0x1f6c5 }, { 0x1f6cc, 0x1f6cc }, { 0x1f6d0, 0x1f6d2 },
+            { 0x1f6d5, 0x1f6d7 }, { 0x1f6dc, 0x1f6df }, { 0x1f6eb, 0x1f6ec },
+            { 0x1f6f4, 0x1f6fc }, { 0x1f7e0, 0x1f7eb }, { 0x1f7f0, 0x1f7f0 },
+            { 0x1f90c, 0x1f93a }, { 0x1f93c, 0x1f945 }, { 0x1f947, 0x1f9ff },
+            { 0x1fa70, 0x1fa7c }, { 0x1fa80, 0x1fa88 }, { 0x1fa90, 0x1fabd },
+            { 0x1fabf, 0x1fac5 }, { 0x1face, 0x1fadb }, { 0x1fae0, 0x1fae8 },
+            { 0x1faf0, 0x1faf8 }, { 0x20000, 0x2fffd }, { 0x30000, 0x3fffd }
+            };
+
+            if (cp < 0x300)
+                return 1;
+            if (in_ranges(cp, zero, sizeof zero / sizeof zero[0]))
+                return 0;
+            if (in_ranges(cp, wide, sizeof wide / sizeof wide[0]))
+                return 2;
+            return 1;
+        }
+
+        // Decoding state carried between successive spans of text.
+        struct width_state
+        {
+            unsigned cp;   // code point decoded so far
+            unsigned need; // continuation bytes still expected
+            unsigned esc;  // position in an escape sequence
+
+            width_state() : cp(0), need(0), esc(0) {}
+        };
+
+        enum { esc_none, esc_start, esc_csi, esc_osc, esc_osc_end };
+
+        // Advance the escape sequence state over character c, and
+        // tell whether c belongs to a sequence. Recognized are CSI
+        // sequences (ESC [ parameters final), OSC sequences (ESC ]
+        // text, ended by BEL or ESC \) and other two-character
+        // sequences, possibly with intermediate characters.
+        inline bool
+        escape_step(unsigned c, width_state& st)
+        {
+            switch (st.esc)
+            {
+            case esc_none:
+                if (c != 0x1B)
+                    return false;
+                st.esc = esc_start;
+                return true;
+            case esc_start:
+                if (c == '[')
+                    st.esc = esc_csi;
+                else if (c == ']')
+                    st.esc = esc_osc;
+                else if (c < 0x20 || c > 0x2F)
+                    st.esc = esc_none;
+                return true;
+            case esc_csi:
+                if (c >= 0x20 && c <= 0x3F)
+                    return true;
+                // A final character ends the sequence; anything else
+                // interrupts it and is not part of it.
+                st.esc = esc_none;
+                return c >= 0x40 && c <= 0x7E;
+            case esc_osc:
+                if (c == 0x07)
+                    st.esc = esc_none;
+                else if (c == 0x1B)
+                    st.esc = esc_osc_end;
+                return true;
+            default:
+                if (c == '\\')
+                {
+                    st.esc = esc_none;
+                    return true;
+                }
+                // The ESC started another sequence.
+                st.esc = esc_start;
+                return escape_step(c, st);
+            }
+        }
+
+#ifdef IO_ALIGN_X86_SIMD
+        // Mark the characters of x that need a closer look.
+        template<bool Utf8, bool Ansi>
+        inline __m128i
+        stop_mask(__m128i x)
+        {
+            __m128i m = Utf8 ? x : _mm_setzero_si128();
+            if (Ansi)
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x1B)));
+            return m;
+        }
+
+        // skip_plain() for spans of at least 16 characters. The mode
+        // is fixed at compile time, which keeps the loops tight.
+        template<bool Utf8, bool Ansi>
+        inline const char*
+        skip_plain_sse2(const char* p, const char* e)
+        {
+            // Test 64 characters at a time, then find the first one
+            // to stop at 16 at a time.
+            for (; e - p >= 64; p += 64)
+            {
+                const __m128i* v = (const __m128i*)p;
+                __m128i x = _mm_or_si128(
+                    _mm_or_si128(stop_mask<Utf8, Ansi>(_mm_loadu_si128(v)),
+                                 stop_mask<Utf8, Ansi>(_mm_loadu_si128(v + 1))),
+                    _mm_or_si128(stop_mask<Utf8, Ansi>(_mm_loadu_si128(v + 2)),
+                                 stop_mask<Utf8, Ansi>(_mm_loadu_si128(v + 3))));
+                if (_mm_movemask_epi8(x))
+                    break;
+            }
+            for (; e - p >= 16; p += 16)
+            {
+                __m128i x = stop_mask<Utf8, Ansi>(_mm_loadu_si128((const __m128i*)p));
+                unsigned m = _mm_movemask_epi8(x);
+                if (m)
+                    return p + __builtin_ctz(m);
+            }
+            if (p == e)
+                return e;
+
+            // Look at the last 16 characters, ignoring those already
+            // seen.
+            const char* q = e - 16;
+            __m128i x = stop_mask<Utf8, Ansi>(_mm_loadu_si128((const __m128i*)q));
+            unsigned m = _mm_movemask_epi8(x);
+            m &= ~0u << (p - q);
+            return m ? q + __builtin_ctz(m) : e;
+        }
+#endif
+
+        // Skip the characters in [p, e) that certainly take one
+        // column each; wide ones only when printable ASCII.
+        template<typename Char>
+        inline const Char*
+        skip_plain(const Char* p, const Char* e, unsigned)
+        {
+            for (; p != e; ++p)
+                if ((unsigned long)*p - 0x20 >= 0x5F)
+                    break;
+            return p;
+        }
+
+        // Skip the characters in [p, e) that take one column each:
+        // ASCII ones with io::width_utf8, all but ESC with
+        // io::width_ansi.
+        inline const char*
+        skip_plain(const char* p, const char* e, unsigned flags)
+        {
+            const bool utf8 = flags & width_utf8, ansi = flags & width_ansi;
+#ifdef IO_ALIGN_X86_SIMD
+            if (e - p >= 16)
+            {
+                if (!ansi)
+                    return utf8 ? skip_plain_sse2<true, false>(p, e) : e;
+                return utf8 ? skip_plain_sse2<true, true>(p, e)
+                            : skip_plain_sse2<false, true>(p, e);
+            }
+#endif
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            // Short spans, 8 characters at a time.
+            for (; e - p >= 8; p += 8)
+            {
+                const unsigned long long ones = 0x0101010101010101ULL;
+                const unsigned long long high = 0x8080808080808080ULL;
+                unsigned long long w, m = 0;
+                __builtin_memcpy(&w, p, 8);
+                if (utf8)
+                    m = w & high;
+                if (ansi)
+                {
+                    // High bit of the lowest ESC, and possibly of
+                    // characters after it.
+                    unsigned long long x = w ^ (0x1B * ones);
+                    m |= (x - ones) & ~x & high;
+                }
+                if (m)
+                    return p + __builtin_ctzll(m) / 8;
+            }
+#endif
+            for (; p != e; ++p)
+                if ((utf8 && (*p & 0x80)) || (ansi && *p == 0x1B))
+                    break;
+            return p;
+        }
+
+        // Display width of the code points in [p, e).
+        template<typename Char>
+        std::size_t
+        display_width(const Char* p, const Char* e, unsigned flags, width_state& st)
+        {
+            std::size_t w = 0;
+            for (; p != e; ++p)
+            {
+                unsigned c = *p;
+                if ((flags & width_ansi) && (st.esc || c == 0x1B) && escape_step(c, st))
+                    continue;
+                w += (flags & width_utf8) ? cp_width(c) : 1;
+            }
+            return w;
+        }
+
+        // Display width of the text in [p, e), from its first
+        // character that is not plain on.
+        inline std::size_t
+        decode_width(const char* p, const char* e, unsigned flags, width_state& st)
+        {
+            const bool utf8 = flags & width_utf8, ansi = flags & width_ansi;
+            std::size_t w = 0;
+            while (p != e)
+            {
+                unsigned char c = *p;
+                if (st.need)
+                {
+                    if ((c & 0xC0) != 0x80)
+                    {
+                        // Truncated sequence; c is looked at again.
+                        st.need = 0;
+                        ++w;
+                        continue;
+                    }
+                    st.cp = (st.cp << 6) | (c & 0x3F);
+                    if (--st.need == 0)
+                        w += cp_width(st.cp);
+                }
+                else if (ansi && (st.esc || c == 0x1B) && escape_step(c, st))
+                    ; // no width
+                else if (!utf8 || c < 0x80)
+                {
+                    const char* q = skip_plain(p + 1, e, flags);
+                    w += q - p;
+                    p = q;
+                    continue;
+                }
+                else if (c >= 0xC2 && c <= 0xDF)
+                    st.cp = c & 0x1F, st.need = 1;
+                else if (c >= 0xE0 && c <= 0xEF)
+                    st.cp = c & 0x0F, st.need = 2;
+                else if (c >= 0xF0 && c <= 0xF4)
+                    st.cp = c & 0x07, st.need = 3;
+                else
+                    ++w;
+                ++p;
+            }
+            return w;
+        }
+
+        // Display width of the narrow text in [p, e). A code point
+        // or escape sequence split across spans is handled when its
+        // last character is seen; invalid UTF-8 bytes count as one
+        // column each.
+        inline std::size_t
+        display_width(const char* p, const char* e, unsigned flags, width_state& st)
+        {
+            if (st.need || st.esc)
+                return decode_width(p, e, flags, st);
+            const char* q = skip_plain(p, e, flags);
+            return q == e ? e - p : (q - p) + decode_width(q, e, flags, st);
+        }
+
+        // Width of the complete text in [p, e).
+        template<typename Char>
+        inline std::size_t
+        text_width(const Char* p, const Char* e, unsigned flags)
+        {
+            if (!flags)
+                return e - p;
+            width_state st;
+            std::size_t w = display_width(p, e, flags, st);
+            return st.need ? w + 1 : w;
+        }
+
+        // Length of the longest start of [p, e) that takes at most
+        // `cols` columns and does not end within a code point or an
+        // escape sequence; its width is stored in `width`.
+        template<typename Char>
+        std::size_t
+        fit_prefix(const Char* p, const Char* e, unsigned flags,
+                   std::size_t cols, std::size_t& width)
+        {
+            if (!flags)
+            {
+                width = std::min<std::size_t>(e - p, cols);
+                return width;
+            }
+            width_state st;
+            std::size_t w = 0, n = 0;
+            width = 0;
+            for (const Char* q = p; q != e; )
+            {
+                w += display_width(q, q + 1, flags, st);
+                ++q;
+                if (st.need || st.esc)
+                    continue;
+                if (w > cols)
+                    break;
+                n = q - p;
+                width = w;
+            }
+            return n;
+        }
+
+        // Append the escape sequences in [p, e) to s.
+        template<typename Char, typename Traits>
+        void
+        append_escapes(const Char* p, const Char* e, std::basic_string<Char, Traits>& s)
+        {
+            width_state st;
+            for (; p != e; ++p)
+                if ((st.esc || *p == 0x1B) && escape_step(*p, st))
+                    s += *p;
+        }
+    }
+
+    template<typename A>
+    inline std::streamoff basic_align_proxy<A>::cursor() const
+    {
+        return counter_.columns();
+    }
+
+    template<typename A>
+    inline typename basic_align_proxy<A>::size_type
+    basic_align_proxy<A>::text_width(const char_type* s, size_type n) const
+    {
+        return detail::text_width(s, s + n, counter_.width());
+    }
+
+    template<typename A>
+    bool basic_align_proxy<A>::at_column_start()
+    {
+        return cursor() == last_pos_;
+    }
+
+    template<typename A>
+    inline void basic_align_proxy<A>::start_cell()
+    {
+        last_pos_ = cursor();
+        cell_off_ = counter_.count();
+    }
+
+    template<typename A>
+    int basic_align_proxy<A>::cap_cell(unsigned col, int w)
+    {
+        int m = a_.maxwidth(col);
+        if (!m || w <= m)
+            return w;
+
+        // The cell can only be cut while it is all in the row buffer.
+        std::streamoff len = counter_.count() - cell_off_;
+        if (len > counter_.pending())
+            return w;
+        size_type start = counter_.pending() - len;
+        const char_type* s = counter_.pending_data() + start;
+        const char_type* e = s + len;
+        const unsigned flags = counter_.width();
+
+        // Leave room for the marker, unless it is too wide itself.
+        bool mark = (cap_mode_ == cap_elide);
+        size_type mw = mark ? text_width(marker_.data(), marker_.size()) : 0;
+        if (mw > (size_type)m)
+            mark = false, mw = 0;
+
+        size_type kw;
+        size_type n = detail::fit_prefix(s, e, flags, m - mw, kw);
+        cut_.clear();
+        if (flags & width_ansi)
+            detail::append_escapes(s + n, e, cut_);
+
+        counter_.truncate(start + n, last_pos_ + kw);
+        counter_.sputn(cut_.data(), cut_.size());
+        if (mark)
+            counter_.sputn(marker_.data(), marker_.size());
+        return cursor() - last_pos_;
+    }
+
+    template<typename A>
+    inline bool basic_align_proxy<A>::buffering() const
+    {
+        // Cells are cut in the row buffer.
+        return rowbuf_ || cap_mode_ != cap_overflow;
+    }
+
+    template<typename A>
+    inline void basic_align_proxy<A>::put_run(counter_type& out, string_type& span,
+                                              char_type c, unsigned n)
+    {
+        // The span grows to the widest run requested so far, so
+        // that any run can be written with a single call.
+        if (span.size() < n)
+            span.assign(n, c);
+        if ((unsigned long)c - 0x20 < 0x5F)
+            // No need to decode the usual fill and rule characters.
+            out.sputn_plain(span.data(), n);
+        else
+            out.sputn(span.data(), n);
+        if (stats_)
+            (&span == &rules_ ? stats_->rule_chars : stats_->padding) += n;
+    }
+
+    template<typename A>
+    inline void basic_align_proxy<A>::put_sep(counter_type& out, char_type c)
+    {
+        out.sputc(c);
+        if (stats_)
+            ++stats_->separators;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::count_width(unsigned col, int before, int after)
+    {
+        if (after <= before)
+            return;
+        if (col >= stats_->widened.size())
+            stats_->widened.resize(col + 1);
+        ++stats_->widened[col];
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setstats(align_stats* stats)
+    {
+        stats_ = stats;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setfill(typename basic_align_proxy<A>::char_type fill_char)
+    {
+        fill_char_ = fill_char;
+        fills_.assign(fills_.size(), fill_char);
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setsep(typename basic_align_proxy<A>::char_type sep_char)
+    {
+        sep_char_ = sep_char;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setrule(typename basic_align_proxy<A>::char_type rule_char)
+    {
+        rule_char_ = rule_char;
+        rules_.assign(rules_.size(), rule_char);
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setrawsep(typename basic_align_proxy<A>::char_type tab_char)
+    {
+        tab_.assign(1, tab_char);
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setrawsep(const typename basic_align_proxy<A>::char_type* sep)
+    {
+        tab_ = sep;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setcsvsep(typename basic_align_proxy<A>::char_type sep)
+    {
+        csv_sep_ = sep;
+    }
+
+    template<typename A>
+    bool basic_align_proxy<A>::inquotes() const
+    {
+        return csv_state_ == detail::csv_quoted;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setwidth(unsigned flags)
+    {
+        counter_.setwidth(flags);
+        start_cell();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setoverflow(cap_mode mode, const char_type* marker)
+    {
+        cap_mode_ = mode;
+        if (marker)
+            marker_.assign(marker);
+        else
+            marker_.assign(3, char_type('.'));
+        if (!holding())
+            counter_.buffer(buffering());
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setrowbuf(bool on)
+    {
+        rowbuf_ = on;
+        if (!holding())
+            counter_.buffer(buffering());
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setflush(flush_policy policy, unsigned long n, int fd)
+    {
+        if (policy == flush_auto)
+        {
+#ifdef IO_ALIGN_POSIX
+            policy = fd >= 0 && isatty(fd) ? flush_row : flush_never;
+#else
+            (void)fd;
+            policy = flush_row;
+#endif
+            n = 1;
+        }
+        flush_ = policy;
+        flush_n_ = n ? n : 1;
+        flush_rows_ = 0;
+        if (policy == flush_bytes)
+            flush_mark_ = counter_.count();
+    }
+
+    template<typename A>
+    long basic_align_proxy<A>::pollflush()
+    {
+        if (flush_ != flush_delay || !flush_rows_)
+            return -1;
+        unsigned long long waited = detail::clock_ms() - flush_mark_;
+        if (waited < flush_n_)
+            return (long)(flush_n_ - waited);
+        flush_rows_ = 0;
+        os_.flush();
+        if (stats_)
+            ++stats_->flushes;
+        return -1;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::maybe_flush()
+    {
+        bool now = false;
+        switch (flush_)
+        {
+        case flush_cell:
+        case flush_row:
+            now = true;
+            break;
+        case flush_rows:
+            now = (++flush_rows_ >= flush_n_);
+            break;
+        case flush_bytes:
+            if ((unsigned long long)counter_.count() - flush_mark_ >= flush_n_)
+            {
+                flush_mark_ = counter_.count();
+                now = true;
+            }
+            break;
+        case flush_delay:
+        {
+            // Time the delay from the first row since the last flush.
+            unsigned long long t = detail::clock_ms();
+            if (flush_rows_++ == 0)
+                flush_mark_ = t;
+            now = (t - flush_mark_ >= flush_n_);
+            break;
+        }
+        default:
+            break;
+        }
+        if (now)
+        {
+            flush_rows_ = 0;
+            os_.flush();
+            if (stats_)
+                ++stats_->flushes;
+        }
+    }
+
+    template<typename A>
+    inline bool basic_align_proxy<A>::holding() const
+    {
+        return max_rows_ || max_bytes_;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::setlookahead(unsigned rows, size_type bytes)
+    {
+        bool was_holding = holding();
+        max_rows_ = rows;
+        max_bytes_ = bytes;
+
+        if (holding())
+        {
+            // Cell text is kept in the counter until the row ends.
+            counter_.buffer(true);
+            counter_.hold(true);
+            emit_.buffer(true);
+        }
+        else if (was_holding)
+        {
+            drain();
+            counter_.hold(false);
+            counter_.buffer(buffering());
+        }
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::hold_row(unsigned rule)
+    {
+        // Grow the ring if it is full.
+        if (win_size_ == window_.size())
+        {
+            std::rotate(window_.begin(), window_.begin() + win_first_, window_.end());
+            win_first_ = 0;
+            window_.resize(window_.size() + 1);
+        }
+
+        held_row& r = window_[(win_first_ + win_size_) % window_.size()];
+        r.text.assign(counter_.pending_data(), counter_.pending());
+        r.ends.swap(cells_);
+        r.rule = rule;
+        cells_.clear();
+        counter_.discard();
+
+        ++win_size_;
+        win_bytes_ += r.text.size();
+
+        // The new row has widened the columns; print the oldest
+        // rows that no longer fit in the window.
+        while (win_size_ > 0 &&
+               ((max_rows_ && win_size_ > max_rows_) ||
+                (max_bytes_ && win_bytes_ > max_bytes_)))
+        {
+            const held_row& o = window_[win_first_];
+            emit_row(o, true);
+            win_bytes_ -= o.text.size();
+            win_first_ = (win_first_ + 1) % window_.size();
+            --win_size_;
+        }
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::drain()
+    {
+        for (; win_size_ > 0; --win_size_)
+        {
+            emit_row(window_[win_first_], true);
+            win_first_ = (win_first_ + 1) % window_.size();
+        }
+        win_bytes_ = 0;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::emit_row(const held_row& r, bool newline)
+    {
+        const unsigned ncols = a_.columns();
+        size_type start = 0;
+
+        for (unsigned i = 0; i < r.ends.size(); ++i)
+        {
+            size_type len = r.ends[i] - start;
+            emit_.sputn(r.text.data() + start, len);
+            len = text_width(r.text.data() + start, len);
+            start = r.ends[i];
+
+            // All cells but the last are padded, as are all the cells
+            // before a rule.
+            if (i + 1 < r.ends.size() || r.rule != no_rule)
+            {
+                if ((size_type)a_.width(i) > len)
+                    put_run(emit_, fills_, fill_char_, a_.width(i) - len);
+                put_sep(emit_, sep_char_);
+            }
+        }
+
+        if (r.rule != no_rule)
+            for (unsigned i = r.rule; i < ncols; ++i)
+            {
+                put_run(emit_, rules_, rule_char_, a_.width(i));
+                if (i + 1 < ncols)
+                    put_sep(emit_, sep_char_);
+            }
+
+        if (newline)
+            put_sep(emit_, '\n');
+        emit_.commit();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::resetheads()
+    {
+        a_.clear_heads();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::reset()
+    {
+        // Held rows were measured against the old widths.
+        drain();
+        resetheads();
+        a_.clear_widths();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::endr()
+    {
+        // The end of a cell also ends any quoted CSV field, and
+        // drops a CR before it as a newline would.
+        csv_state_ = detail::csv_plain;
+        csv_cr_ = false;
+
+        bool acs = at_column_start();
+        bool skip_newline = at_begin_ && acs;
+
+        if (skip_newline)
+        {
+            // Start new row
+            col_ = 0;
+            start_cell();
+            at_begin_ = true;
+            return;
+        }
+
+        pre_tab();
+        if (holding())
+            cells_.push_back(counter_.pending());
+        complete_row();
+    }
+
+    template<typename A>
+    inline unsigned
+    basic_align_proxy<A>::pre_tab()
+    {
+        return fit_cell(col_, cell_width());
+    }
+
+    template<typename A>
+    int
+    basic_align_proxy<A>::cell_width()
+    {
+        // See where we are in the stream.
+        int w = cursor() - last_pos_;
+        if (w < 0)
+            w = 0;
+        if (cap_mode_ != cap_overflow)
+            w = cap_cell(col_, w);
+        if (stats_)
+        {
+            ++stats_->cells;
+            stats_->payload += counter_.count() - cell_off_;
+        }
+        return w;
+    }
+
+    template<typename A>
+    unsigned
+    basic_align_proxy<A>::fit_cell(unsigned col, int w)
+    {
+        // Adjust the current known width. A cell wider than the
+        // maximum width of its column is not padded.
+        if (stats_)
+        {
+            int before = a_.width(col);
+            int width = a_.fit(col, w);
+            count_width(col, before, width);
+            return width > w ? width - w : 0;
+        }
+        int width = a_.fit(col, w);
+        return width > w ? width - w : 0;
+    }
+
+
+    template<typename A>
+    void basic_align_proxy<A>::complete_column()
+    {
+        unsigned remainder = pre_tab();
+
+        if (holding())
+            // Only mark the end of the cell; padding is added when
+            // the row is printed.
+            cells_.push_back(counter_.pending());
+        else
+        {
+            // Pad until end of column.
+            put_run(counter_, fills_, fill_char_, remainder);
+
+            // Separator.
+            put_sep(counter_, sep_char_);
+        }
+
+        // Adjust column.
+        ++col_;
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::complete_row(unsigned rule)
+    {
+        // Complete the row.
+        if (holding())
+            hold_row(rule);
+        else
+        {
+            put_sep(counter_, '\n');
+            counter_.commit();
+        }
+
+        // Start new row.
+        col_ = 0;
+        start_cell();
+        at_begin_ = true;
+
+        if (stats_)
+            ++stats_->rows;
+        if (flush_ != flush_never)
+            maybe_flush();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::tab()
+    {
+        if (csv_cr_)
+        {
+            const char_type cr = '\r';
+            csv_cr_ = false;
+            put_csv(&cr, &cr + 1);
+        }
+        csv_state_ = detail::csv_plain;
+
+        // Pad until end of column.
+        complete_column();
+
+        // Move the cursors forward.
+        at_begin_ = false;
+        start_cell();
+
+        if (flush_ == flush_cell)
+        {
+            os_.flush();
+            if (stats_)
+                ++stats_->flushes;
+        }
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::next()
+    {
+        if (col_ + 1 < a_.columns())
+            tab();
+        else
+            endr();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::hline()
+    {
+        if (col_ + 1 < a_.columns())
+        {
+            if (!at_column_start())
+                complete_column();
+            if (stats_)
+                ++stats_->rules;
+
+            if (holding())
+            {
+                // The rule is drawn when the row is printed.
+                complete_row(col_);
+                return;
+            }
+
+            // Fill the remainder of the row with a rule.
+            const unsigned ncols = a_.columns();
+            for (unsigned i = col_; i < ncols; ++i)
+            {
+                put_run(counter_, rules_, rule_char_, a_.width(i));
+                if (i + 1 < ncols)
+                    put_sep(counter_, sep_char_);
+            }
+
+            complete_row();
+        }
+        else
+            endr();
+    }
+
+    template<typename A>
+    void basic_align_proxy<A>::heads()
+    {
+        if (col_ + 1 < a_.columns())
+        {
+            if (!at_column_start())
+                complete_column();
+
+            // Print out the headers.
+            const unsigned nheads = a_.nheads();
+            if (stats_)
+            {
+                ++stats_->heads;
+                stats_->cells += nheads - col_;
+            }
+            for (unsigned i = col_; i < nheads; ++i)
+            {
+                const string_type& h = a_.head(i);
+                start_cell();
+                counter_.sputn(h.data(), h.size());
+                int w = text_width(h.data(), h.size());
+                if (cap_mode_ != cap_overflow)
+                    w = cap_cell(i, w);
+                if (stats_)
+                    stats_->payload += counter_.count() - cell_off_;
+                if (holding())
+                    cells_.push_back(counter_.pending());
+                else if (i + 1 < nheads)
+                {
+                    if (a_.width(i) > w)
+                        put_run(counter_, fills_, fill_char_, a_.width(i) - w);
+                    put_sep(counter_, sep_char_);
+                }
+            }
+            complete_row();
+        }
+        else
+            endr();
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::sethead(const typename basic_align_proxy<A>::char_type* s,
+                                  unsigned w, size_type len)
+    {
+        if (len == string_type::npos)
+            len = traits_type::length(s);
+
+        // Place the label in the heads array.
+        a_.set_head(col_, s, len);
+
+        size_type hlen = text_width(s, len);
+        size_type clen = w > hlen ? w : hlen;
+        // Now adjust the widths.
+        if (stats_)
+        {
+            int before = a_.width(col_);
+            count_width(col_, before, a_.fit(col_, clen));
+        }
+        else
+            a_.fit(col_, clen);
+
+        // Adjust column.
+        ++col_;
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::rawheads(const typename basic_align_proxy<A>::char_type* s)
+    {
+        parse(s, s + traits_type::length(s), true);
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::raw(const typename basic_align_proxy<A>::char_type* s)
+    {
+        parse(s, s + traits_type::length(s), false);
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::rawheads(const typename basic_align_proxy<A>::char_type* s,
+                                   typename basic_align_proxy<A>::size_type n)
+    {
+        parse(s, s + n, true);
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::raw(const typename basic_align_proxy<A>::char_type* s,
+                              typename basic_align_proxy<A>::size_type n)
+    {
+        parse(s, s + n, false);
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::parse(const char_type* s, const char_type* e, bool heads)
+    {
+        const detail::raw_splitter<char_type> split(tab_.data(), tab_.size());
+
+        s = split.start(s, e);
+        for (;;)
+        {
+            const char_type* c = s;
+            const char_type* d;
+            detail::raw_boundary b = split.next(s, e, d);
+            if (b == detail::raw_end && d == c)
+                break;
+
+            if (heads)
+                sethead(c, 0, d - c);
+            else
+                counter_.sputn(c, d - c);
+
+            if (b == detail::raw_end)
+                break;
+            if (b == detail::raw_row)
+            {
+                endr();
+                s = split.start(s, e);
+            }
+            else if (!heads)
+                tab();
+        }
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::raw_csv(const typename basic_align_proxy<A>::char_type* s)
+    {
+        raw_csv(s, traits_type::length(s));
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::raw_csv(const typename basic_align_proxy<A>::char_type* s,
+                                  typename basic_align_proxy<A>::size_type n)
+    {
+        const char_type nl = '\n', cr = '\r';
+        const char_type* e = s + n;
+        if (s == e)
+            return;
+
+        // A CR that ended the last text is dropped if a newline
+        // follows it.
+        if (csv_cr_)
+        {
+            csv_cr_ = false;
+            if (*s != nl)
+                put_csv(&cr, &cr + 1);
+        }
+
+        for (;;)
+        {
+            bool quoted = (csv_state_ == detail::csv_quoted);
+            const char_type* d = detail::find_csv(s, e, csv_sep_, quoted);
+            if (d == e)
+            {
+                // Hold back a CR until the next character is known.
+                if (e[-1] == cr)
+                {
+                    csv_cr_ = true;
+                    --e;
+                }
+                put_csv(s, e);
+                break;
+            }
+
+            if (*d == nl && d > s && d[-1] == '\r')
+                put_csv(s, d - 1);
+            else
+                put_csv(s, d);
+
+            if (*d == nl)
+                endr();
+            else
+                tab();
+
+            s = d + 1;
+        }
+    }
+
+    template<typename A>
+    void
+    basic_align_proxy<A>::put_csv(const typename basic_align_proxy<A>::char_type* s,
+                                  const typename basic_align_proxy<A>::char_type* e)
+    {
+        if (s == e)
+            return;
+
+        // Most cells have no quotes, or only quotes around them, and
+        // are passed on as they are.
+        if (csv_state_ != detail::csv_quoted)
+        {
+            const char_type* q = traits_type::find(s, e - s, '"');
+            if (!q)
+            {
+                counter_.sputn(s, e - s);
+                csv_state_ = detail::csv_plain;
+                return;
+            }
+            if (q == s && e - s >= 2 && e[-1] == '"' && csv_state_ == detail::csv_plain &&
+                !traits_type::find(s + 1, e - s - 2, '"') &&
+                !traits_type::find(s + 1, e - s - 2, '\n') &&
+                !traits_type::find(s + 1, e - s - 2, '\r'))
+            {
+                counter_.sputn(s + 1, e - s - 2);
+                csv_state_ = detail::csv_closed;
+                return;
+            }
+        }
+        csv_cell_.clear();
+        csv_state_ = detail::csv_unquote(s, e, csv_state_, csv_cell_);
+        counter_.sputn(csv_cell_.data(), csv_cell_.size());
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    hline(basic_align_proxy<A>& os)
+    {
+        os.hline();
+        return os;
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    endr(basic_align_proxy<A>& os)
+    {
+        os.endr();
+        return os;
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    tab(basic_align_proxy<A>& os)
+    {
+        os.tab();
+        return os;
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    next(basic_align_proxy<A>& os)
+    {
+        os.next();
+        return os;
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    reset(basic_align_proxy<A>& os)
+    {
+        os.reset();
+        return os;
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    resetheads(basic_align_proxy<A>& os)
+    {
+        os.resetheads();
+        return os;
+    }
+
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    heads(basic_align_proxy<A>& os)
+    {
+        os.heads();
+        return os;
+    }
+
+    template<typename Char>
+    class sethead_ {
+        const Char* s_;
+        unsigned w_;
+
+        template<typename A>
+        friend class basic_align_proxy;
+
+    public:
+        sethead_(const Char* s, unsigned w) : s_(s), w_(w) {}
+    };
+
+    template<typename Char>
+    inline sethead_<Char>
+    head(const Char* s, unsigned width)
+    {
+        return sethead_<Char>(s, width);
+    }
+    template<typename Char, typename Traits>
+    inline sethead_<Char>
+    head(const std::basic_string<Char, Traits>& s, unsigned width)
+    {
+        return sethead_<Char>(s.c_str(), width);
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    basic_align_proxy<A>::operator<<(const sethead_<typename basic_align_proxy<A>::char_type>& h)
+    {
+        sethead(h.s_, h.w_);
+        return *this;
+    }
+
+
+    template<typename Char, bool heads>
+    class raw_ {
+        const Char* s_;
+        std::size_t n_;
+
+        template<typename A>
+        friend class basic_align_proxy;
+
+    public:
+        raw_(const Char* s, std::size_t n = std::size_t(-1)) : s_(s), n_(n) {}
+    };
+
+    template<typename Char>
+    inline raw_<Char, false>
+    raw(const Char *s)
+    {
+        return raw_<Char, false>(s);
+    }
+    template<typename Char, typename Traits>
+    inline raw_<Char, false>
+    raw(const std::basic_string<Char, Traits>& s)
+    {
+        return raw_<Char, false>(s.c_str());
+    }
+    template<typename Char>
+    inline raw_<Char, false>
+    raw(const Char *s, std::size_t n)
+    {
+        return raw_<Char, false>(s, n);
+    }
+    template<typename Char>
+    inline raw_<Char, true>
+    rawheads(const Char *s)
+    {
+        return raw_<Char, true>(s);
+    }
+    template<typename Char, typename Traits>
+    inline raw_<Char, true>
+    rawheads(const std::basic_string<Char, Traits>& s)
+    {
+        return raw_<Char, true>(s.c_str());
+    }
+    template<typename Char>
+    inline raw_<Char, true>
+    rawheads(const Char *s, std::size_t n)
+    {
+        return raw_<Char, true>(s, n);
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    basic_align_proxy<A>::operator<<(const raw_<typename basic_align_proxy<A>::char_type, false>& r)
+    {
+        if (r.n_ == std::size_t(-1))
+            raw(r.s_);
+        else
+            raw(r.s_, r.n_);
+        return *this;
+    }
+    template<typename A>
+    inline basic_align_proxy<A>&
+    basic_align_proxy<A>::operator<<(const raw_<typename basic_align_proxy<A>::char_type, true>& r)
+    {
+        if (r.n_ == std::size_t(-1))
+            rawheads(r.s_);
+        else
+            rawheads(r.s_, r.n_);
+        return *this;
+    }
+
+
+    template<typename Char, typename Traits>
+    class ocounter: public std::basic_streambuf<Char, Traits>
+    {
+    public:
+        typedef std::basic_streambuf<Char, Traits> streambuf_type;
+        typedef typename Traits::int_type          int_type;
+
+        explicit ocounter(streambuf_type* sb)
+            : streambuf_type(), sb_(0), down_(0), ups_(0), next_up_(0),
+              count_(0), buf_(), buffered_(false), held_(false), classic_(true),
+              flags_(width_bytes), extra_(0), scanned_(0), state_()
+        {
+            link(sb);
+        }
+
+        /// Pass on the counters that write to this one to its target.
+        ~ocounter()
+        {
+            while (ups_)
+                ups_->retarget(sb_);
+            unlink();
+        }
+
+        /// The stream buffer that receives the characters.
+        streambuf_type* target() const { return sb_; }
+
+        /** @brief Send the characters to another stream buffer.
+         *
+         * Called when the counter that this one writes to goes away
+         * before it, as when the proxies attached to a stream are not
+         * destroyed in the reverse order of their creation.
+         */
+        void retarget(streambuf_type* sb)
+        {
+            unlink();
+            link(sb);
+        }
+
+        /// The number of characters written so far, including pending ones.
+        std::streamoff count() const { return count_ + pending(); }
+
+        /// The number of columns written so far, including pending characters.
+        std::streamoff columns() const
+        {
+            if (!flags_)
+                return count();
+            if (scanned_ != pending())
+                scan();
+            return count() + extra_;
+        }
+
+        /// How columns are counted; see width_flags.
+        unsigned width() const { return flags_; }
+
+        /// Whether the locale last imbued is the classic one.
+        bool classic() const { return classic_; }
+
+        /// Choose how columns are counted; see width_flags.
+        void setwidth(unsigned flags)
+        {
+            flags_ = flags;
+            extra_ = 0;
+            scanned_ = pending();
+            state_ = detail::width_state();
+        }
+
+        /// The number of characters held back in the row buffer.
+        std::streamsize pending() const { return this->pptr() - this->pbase(); }
+
+        /// The characters held back in the row buffer.
+        const Char* pending_data() const { return this->pbase(); }
+
+        /// Whether characters are held back until commit().
+        bool buffered() const { return buffered_; }
+
+        /// Start or stop holding back characters until commit().
+        void buffer(bool on)
+        {
+            if (on == buffered_)
+                return;
+            commit();
+            buffered_ = on;
+            if (!on)
+                this->setp(0, 0);
+            else
+            {
+                if (buf_.empty())
+                    buf_.resize(256);
+                this->setp(&buf_[0], &buf_[0] + buf_.size());
+            }
+        }
+
+        /// Write characters known to take one column each, without decoding them.
+        std::streamsize sputn_plain(const Char* s, std::streamsize n)
+        {
+            if (!flags_ || state_.need || state_.esc)
+                return this->sputn(s, n);
+            if (scanned_ != pending())
+                scan();
+            if (buffered_)
+            {
+                reserve(pending() + n);
+                Traits::copy(this->pptr(), s, n);
+                this->pbump(n);
+                scanned_ = pending();
+                return n;
+            }
+            if (!sb_)
+                return 0;
+            std::streamsize r = sb_->sputn(s, n);
+            count_ += r;
+            return r;
+        }
+
+        /** @brief Add n characters after the pending ones.
+         *
+         * Returns the row buffer, where the caller sets them. They are
+         * counted as one column each.
+         */
+        Char* extend(std::streamsize n)
+        {
+            if (scanned_ != pending())
+                scan();
+            reserve(pending() + n);
+            this->pbump(n);
+            scanned_ = pending();
+            return this->pbase();
+        }
+
+        /// Keep the pending characters when the stream is flushed.
+        void hold(bool on) { held_ = on; }
+
+        /// Drop the pending characters.
+        void discard()
+        {
+            // The columns counted so far stay as they are.
+            if (scanned_ != pending())
+                scan();
+            extra_ += pending();
+            this->setp(this->pbase(), this->epptr());
+            scanned_ = 0;
+        }
+
+        /** @brief Drop the pending characters from the nth on.
+         * @param n The number of pending characters to keep.
+         * @param cols The number of columns counted up to them.
+         *
+         * The kept characters must not end within a code point or an
+         * escape sequence.
+         */
+        void truncate(std::streamsize n, std::streamoff cols)
+        {
+            this->setp(this->pbase(), this->epptr());
+            this->pbump(n);
+            scanned_ = n;
+            extra_ = cols - count();
+            state_ = detail::width_state();
+        }
+
+        /// Pass the pending characters to the target with a single write.
+        void commit()
+        {
+            std::streamsize n = pending();
+            if (n == 0)
+                return;
+            if (scanned_ != n)
+                scan();
+            if (sb_)
+                sb_->sputn(this->pbase(), n);
+            count_ += n;
+            this->setp(this->pbase(), this->epptr());
+            scanned_ = 0;
+        }
+
+    protected:
+        virtual void imbue(const std::locale& loc)
+        {
+            classic_ = (loc == std::locale::classic());
+        }
+
+        virtual int_type overflow(int_type c)
+        {
+            if (Traits::eq_int_type(c, Traits::eof()))
+                return Traits::not_eof(c);
+            if (buffered_)
+            {
+                reserve(pending() + 1);
+                *this->pptr() = Traits::to_char_type(c);
+                this->pbump(1);
+                return c;
+            }
+            if (!sb_)
+                return Traits::eof();
+            Char ch = Traits::to_char_type(c);
+            int_type r = sb_->sputc(ch);
+            if (!Traits::eq_int_type(r, Traits::eof()))
+            {
+                ++count_;
+                // Separators are usually printable ASCII.
+                if (flags_ && ((unsigned long)ch - 0x20 >= 0x5F || state_.need || state_.esc))
+                    add(&ch, &ch + 1);
+            }
+            return r;
+        }
+
+        virtual std::streamsize xsputn(const Char* s, std::streamsize n)
+        {
+            if (buffered_)
+            {
+                // Count what came in through sputc() first, so that
+                // the text is only looked at once.
+                bool seen = (scanned_ == pending());
+                reserve(pending() + n);
+                Traits::copy(this->pptr(), s, n);
+                this->pbump(n);
+                if (flags_ && seen)
+                {
+                    add(s, s + n);
+                    scanned_ = pending();
+                }
+                return n;
+            }
+            if (!sb_)
+                return 0;
+            std::streamsize r = sb_->sputn(s, n);
+            count_ += r;
+            if (flags_)
+                add(s, s + r);
+            return r;
+        }
+
+        virtual int sync()
+        {
+            if (!held_)
+                commit();
+            return sb_ ? sb_->pubsync() : 0;
+        }
+
+    private:
+        ocounter(const ocounter&);
+        ocounter& operator=(const ocounter&);
+
+        // Ensure the row buffer can hold n characters, keeping
+        // the pending ones.
+        void reserve(std::streamsize n)
+        {
+            std::streamsize p = pending();
+            if (n <= (std::streamsize)buf_.size())
+                return;
+            buf_.resize(std::max<std::streamsize>(n, 2 * buf_.size()));
+            this->setp(&buf_[0], &buf_[0] + buf_.size());
+            this->pbump(p);
+        }
+
+        // Write to sb, and if it is a counter, register with it so
+        // that it can pass on its target when it is destroyed.
+        void link(streambuf_type* sb)
+        {
+            sb_ = sb;
+            down_ = dynamic_cast<ocounter*>(sb);
+            if (down_)
+            {
+                next_up_ = down_->ups_;
+                down_->ups_ = this;
+            }
+        }
+
+        void unlink()
+        {
+            if (!down_)
+                return;
+            for (ocounter** p = &down_->ups_; *p; p = &(*p)->next_up_)
+                if (*p == this)
+                {
+                    *p = next_up_;
+                    break;
+                }
+            down_ = 0;
+            next_up_ = 0;
+        }
+
+        // Count the columns of [p, e) beyond one per character. Plain
+        // text, the common case, is only checked, never decoded.
+        void add(const Char* p, const Char* e) const
+        {
+            if (!state_.need && !state_.esc)
+            {
+                p = detail::skip_plain(p, e, flags_);
+                if (p == e)
+                    return;
+            }
+            extra_ += (std::streamoff)detail::display_width(p, e, flags_, state_) - (e - p);
+        }
+
+        // Count the columns of the pending characters not yet seen.
+        void scan() const
+        {
+            if (flags_)
+                add(this->pbase() + scanned_, this->pptr());
+            scanned_ = pending();
+        }
+
+        streambuf_type*   sb_;
+        ocounter*         down_;    // sb_, if it is a counter
+        ocounter*         ups_;     // first counter writing to this one
+        ocounter*         next_up_; // next counter writing to down_
+        std::streamoff    count_;
+        std::vector<Char> buf_;
+        bool              buffered_;
+        bool              held_;
+        bool              classic_; // whether the locale is the classic one
+
+        // Column counting.
+        unsigned                    flags_;
+        mutable std::streamoff      extra_;   // columns beyond count() up to scanned_
+        mutable std::streamsize     scanned_; // pending characters counted
+        mutable detail::width_state state_;
+    };
+
+
+    template<typename Align>
+    basic_align_proxy<Align>::basic_align_proxy(typename Align::stream_type& os, Align& a,
+                                                typename basic_align_proxy<Align>::char_type f,
+                                                typename basic_align_proxy<Align>::char_type s,
+                                                typename basic_align_proxy<Align>::char_type r,
+                                                typename basic_align_proxy<Align>::char_type t)
+        : os_(os), a_(a), col_(0),
+          last_pos_(0),
+          at_begin_(true),
+          counter_(os.rdbuf()),
+          fill_char_(f),
+          sep_char_(s),
+          rule_char_(r),
+          tab_(1, t),
+          csv_sep_(','),
+          csv_state_(detail::csv_plain),
+          csv_cr_(false),
+          csv_cell_(),
+          fills_(),
+          rules_(),
+          rowbuf_(false),
+          taken_(false),
+          cap_mode_(cap_overflow),
+          marker_(),
+          cut_(),
+          cell_off_(0),
+          flush_(flush_never),
+          flush_n_(1),
+          flush_rows_(0),
+          flush_mark_(0),
+          stats_(0),
+          max_rows_(0),
+          max_bytes_(0),
+          window_(),
+          win_first_(0),
+          win_size_(0),
+          win_bytes_(0),
+          cells_(),
+          emit_(os.rdbuf())
+    {
+        bind();
+    }
+
+    template<typename Align>
+    basic_align_proxy<Align>::basic_align_proxy(const basic_align_proxy<Align>& o)
+        : os_(o.os_), a_(o.a_), col_(o.col_),
+          last_pos_(0),
+          at_begin_(o.at_begin_),
+          counter_(o.counter_.target()),
+          fill_char_(o.fill_char_),
+          sep_char_(o.sep_char_),
+          rule_char_(o.rule_char_),
+          tab_(o.tab_),
+          csv_sep_(o.csv_sep_),
+          csv_state_(o.csv_state_),
+          csv_cr_(o.csv_cr_),
+          csv_cell_(),
+          fills_(o.fills_),
+          rules_(o.rules_),
+          rowbuf_(o.rowbuf_),
+          taken_(false),
+          cap_mode_(o.cap_mode_),
+          marker_(o.marker_),
+          cut_(),
+          cell_off_(0),
+          flush_(o.flush_),
+          flush_n_(o.flush_n_),
+          flush_rows_(o.flush_rows_),
+          flush_mark_(o.flush_mark_),
+          stats_(o.stats_),
+          max_rows_(o.max_rows_),
+          max_bytes_(o.max_bytes_),
+          window_(o.window_),
+          win_first_(o.win_first_),
+          win_size_(o.win_size_),
+          win_bytes_(o.win_bytes_),
+          cells_(o.cells_),
+          emit_(o.counter_.target())
+    {
+        emit_.buffer(o.holding());
+
+        // Carry over the pending part of the row, if any.
+        counter_.setwidth(o.counter_.width());
+        counter_.buffer(o.counter_.buffered());
+        counter_.hold(o.holding());
+        counter_.sputn(o.counter_.pending_data(), o.counter_.pending());
+        last_pos_ = cursor() - (o.cursor() - o.last_pos_);
+        cell_off_ = counter_.count() - (o.counter_.count() - o.cell_off_);
+        o.taken_ = true;
+        bind();
+    }
+
+    template<typename Align>
+    void basic_align_proxy<Align>::bind()
+    {
+        // Route the stream through the counter. Changing the stream
+        // buffer clears the stream state, so preserve it. The stream
+        // passes later changes of its locale on to the counter.
+        counter_.pubimbue(os_.getloc());
+        std::ios_base::iostate st = os_.rdstate();
+        os_.rdbuf(&counter_);
+        os_.clear(st);
+    }
+
+    template<typename Align>
+    basic_align_proxy<Align>::~basic_align_proxy()
+    {
+        // A copy that took over the stream prints the rest.
+        if (taken_)
+            return;
+
+        if (holding())
+        {
+            // Print the held rows, then the current row as far
+            // as it goes.
+            drain();
+            if (counter_.pending() > 0 || !cells_.empty())
+            {
+                held_row r;
+                cells_.push_back(counter_.pending());
+                r.text.assign(counter_.pending_data(), counter_.pending());
+                r.ends.swap(cells_);
+                counter_.discard();
+                emit_row(r, false);
+            }
+        }
+        counter_.commit();
+
+        // If a proxy attached later still routes the stream, the
+        // counter passes our target on to it when destroyed.
+        if (os_.rdbuf() == &counter_)
+        {
+            std::ios_base::iostate st = os_.rdstate();
+            os_.rdbuf(counter_.target());
+            os_.clear(st);
+        }
+    }
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    operator<<(basic_align_proxy<A>& s,
+               typename A::stream_type& (*op)(typename A::stream_type&))
+    {
+        op(s.os_);
+        return s;
+    };
+
+    template<typename A>
+    inline basic_align_proxy<A>&
+    operator<<(basic_align_proxy<A>& s,
+               basic_align_proxy<A>& (*op)(basic_align_proxy<A>&))
+    {
+        return op(s);
+    };
+
+
+    template<typename A>
+    template<typename T>
+    basic_align_proxy<A>&
+    basic_align_proxy<A>::operator<<(const T& t)
+    {
+        put(t);
+        return *this;
     }
 
     template<typename A>
-    void basic_align_proxy<A>::setrawsep(typename basic_align_proxy<A>::char_type tab_char)
+    template<typename T>
+    inline void basic_align_proxy<A>::put(const T& t)
     {
-        tab_char_ = tab_char;
+        os_ << t;
     }
 
+#if __cplusplus >= 201103L
     template<typename A>
-    void basic_align_proxy<A>::resetheads()
+    template<typename... T>
+    basic_align_proxy<A>&
+    basic_align_proxy<A>::row(const T&... cells)
     {
-        a_.heads_.clear();
+        // Collect the row, even if rows are not buffered otherwise.
+        bool buffered = counter_.buffered();
+        if (!buffered)
+            counter_.buffer(true);
+
+        const unsigned n = sizeof...(T);
+        if (n > 1 && !holding() && flush_ != flush_cell && at_begin_ && at_column_start())
+        {
+            // Format all the cells first, then fit the columns to
+            // them and pad them in the row buffer in one pass.
+            size_type ends[n > 1 ? n : 1];
+            int widths[n > 1 ? n : 1];
+            size_type start = counter_.pending();
+            measure_cells(ends, widths, cells...);
+            pad_cells(start, ends, widths, n);
+            csv_state_ = detail::csv_plain;
+            csv_cr_ = false;
+            complete_row();
+        }
+        else
+        {
+            // A row that continues what was written before, that is
+            // held back or flushed after each cell goes cell by cell.
+            put_cells(cells...);
+            endr();
+        }
+
+        if (!buffered)
+            counter_.buffer(false);
+        return *this;
     }
 
     template<typename A>
-    void basic_align_proxy<A>::reset()
+    template<typename T, typename... Rest>
+    inline void
+    basic_align_proxy<A>::measure_cells(size_type* ends, int* widths,
+                                        const T& cell, const Rest&... rest)
     {
-        resetheads();
-        a_.widths_.clear();
+        *this << cell;
+        *widths = cell_width();
+        *ends = counter_.pending();
+        ++col_;
+        start_cell();
+        measure_cells(ends + 1, widths + 1, rest...);
     }
 
     template<typename A>
-    void basic_align_proxy<A>::endr()
+    void
+    basic_align_proxy<A>::pad_cells(size_type start, const size_type* ends, int* widths,
+                                    unsigned n)
     {
-        bool acs = at_column_start();
-        bool skip_newline = at_begin_ && acs;
+        // Widen the columns; widths then holds the padding of each
+        // cell. The last one is not padded.
+        size_type extra = n - 1;
+        for (unsigned i = 0; i < n; ++i)
+        {
+            widths[i] = fit_cell(i, widths[i]);
+            if (i + 1 < n)
+                extra += widths[i];
+        }
+        if (stats_)
+        {
+            stats_->padding += extra - (n - 1);
+            stats_->separators += n - 1;
+        }
 
-        if (!skip_newline)
+        // Move the cells to their final place, from the last one on,
+        // with the padding and a separator after each.
+        char_type* b = counter_.extend(extra);
+        size_type to = ends[n - 1] + extra;
+        for (unsigned i = n; i-- > 0;)
         {
-            pre_tab();
-            os_ << '\n';
-            os_.flush();
+            size_type from = i ? ends[i - 1] : start;
+            to -= ends[i] - from;
+            traits_type::move(b + to, b + from, ends[i] - from);
+            if (i)
+            {
+                b[--to] = sep_char_;
+                to -= widths[i - 1];
+                traits_type::assign(b + to, widths[i - 1], fill_char_);
+            }
         }
+    }
 
-        // Start new row
-        col_ = 0;
-        last_pos_ = cursor_;
-        at_begin_ = true;
+    template<typename A>
+    template<typename T, typename... Rest>
+    inline void
+    basic_align_proxy<A>::put_cells(const T& cell, const Rest&... rest)
+    {
+        *this << cell;
+        if (sizeof...(rest) > 0)
+        {
+            tab();
+            put_cells(rest...);
+        }
     }
 
     template<typename A>
-    unsigned
-    basic_align_proxy<A>::pre_tab()
+    template<typename... T>
+    basic_align_proxy<A>&
+    basic_align_proxy<A>::heads_row(const T&... titles)
     {
-        // Ensure there is enough room in the
-        // widths array for the current column.
-        if (col_ >= a_.widths_.size())
-            a_.widths_.resize(col_ + 1);
+        bool buffered = counter_.buffered();
+        if (!buffered)
+            counter_.buffer(true);
 
-        // See where we are in the stream.
-        pos_type cur_pos = cursor_;
-        int w = cur_pos - last_pos_;
-        if (w < 0)
-            w = 0;
+        set_heads(titles...);
+        endr();
+        heads();
 
-        // Adjust the current known width.
-        int prev_w = a_.widths_[col_];
-        if (w > prev_w)
-            a_.widths_[col_] = prev_w = w;
+        if (!buffered)
+            counter_.buffer(false);
+        return *this;
+    }
 
-        return prev_w - w;
+    template<typename A>
+    template<typename T, typename... Rest>
+    inline void
+    basic_align_proxy<A>::set_heads(const T& title, const Rest&... rest)
+    {
+        *this << head(title);
+        set_heads(rest...);
     }
+#endif
 
+#ifdef IO_ALIGN_TO_CHARS
+    template<typename A>
+    inline bool basic_align_proxy<A>::fast_numbers(std::ios_base::fmtflags f) const
+    {
+        // Anything that involves the locale, padding or flushing is
+        // left to the stream.
+        return counter_.classic() && os_.good() && os_.width() == 0 && !os_.tie() &&
+            !(f & (std::ios_base::showbase | std::ios_base::showpos |
+                   std::ios_base::showpoint | std::ios_base::unitbuf));
+    }
 
     template<typename A>
-    void basic_align_proxy<A>::complete_column()
+    template<typename T>
+    void basic_align_proxy<A>::put_integer(T v)
     {
-        unsigned remainder = pre_tab();
+        std::ios_base::fmtflags f = os_.flags();
+        if (!fast_numbers(f))
+        {
+            os_ << v;
+            return;
+        }
 
-        // Pad until end of column.
-        for (unsigned i = 0; i < remainder; ++i)
-            os_ << fill_char_;
+        // Like the stream, print negative values in hex and octal
+        // as their unsigned counterparts.
+        typedef typename std::make_unsigned<T>::type U;
+        char buf[std::numeric_limits<U>::digits + 2];
+        std::to_chars_result r;
+        switch (f & std::ios_base::basefield)
+        {
+        case std::ios_base::hex:
+            r = std::to_chars(buf, buf + sizeof buf, U(v), 16);
+            break;
+        case std::ios_base::oct:
+            r = std::to_chars(buf, buf + sizeof buf, U(v), 8);
+            break;
+        default:
+            r = std::to_chars(buf, buf + sizeof buf, v);
+        }
+        put_number(buf, r.ptr, f & std::ios_base::uppercase);
+    }
+
+    template<typename A>
+    template<typename T>
+    void basic_align_proxy<A>::put_float(T v)
+    {
+        std::ios_base::fmtflags f = os_.flags();
+        std::streamsize prec = os_.precision();
+        std::ios_base::fmtflags ff = f & std::ios_base::floatfield;
+        if (!fast_numbers(f) || prec < 0 ||
+            ff == (std::ios_base::fixed | std::ios_base::scientific))
+        {
+            os_ << v;
+            return;
+        }
 
-        // Separator.
-        os_ << sep_char_;
+        char buf[128];
+        std::to_chars_result r;
+        if (ff == std::ios_base::fixed)
+            r = std::to_chars(buf, buf + sizeof buf, v, std::chars_format::fixed, prec);
+        else if (ff == std::ios_base::scientific)
+            r = std::to_chars(buf, buf + sizeof buf, v, std::chars_format::scientific, prec);
+        else
+            r = std::to_chars(buf, buf + sizeof buf, v, std::chars_format::general, prec);
 
-        // Adjust column.
-        ++col_;
+        // Very long fixed-point numbers do not fit.
+        if (r.ec != std::errc())
+            os_ << v;
+        else
+            put_number(buf, r.ptr, f & std::ios_base::uppercase);
     }
 
     template<typename A>
-    void basic_align_proxy<A>::complete_row()
+    void basic_align_proxy<A>::put_number(char* s, char* e, bool upper)
     {
-        // Complete the row.
-        os_ << '\n';
+        char_type out[128];
+        char_type* d = out;
+        for (; s != e; ++s, ++d)
+            *d = (upper && *s >= 'a' && *s <= 'z') ? *s - 'a' + 'A' : *s;
+        if (counter_.sputn(out, d - out) != d - out)
+            os_.setstate(std::ios_base::badbit);
+    }
+#endif
 
-        // Update cursor.
-        os_.flush();
+    template<typename O>
+    typename basic_align<O>::proxy_type
+    basic_align<O>::attach(O& os,
+                           typename O::char_type f,
+                           typename O::char_type s,
+                           typename O::char_type r,
+                           typename O::char_type t)
+    {
+        return proxy_type(os, *this, f, s, r, t);
+    }
 
-        // Start new row.
-        col_ = 0;
-        last_pos_ = cursor_;
-        at_begin_ = true;
+    template<typename O>
+    basic_align<O>::basic_align()
+        : widths_(), heads_(), nheads_(0), maxwidths_(), maxwidth_(0)
+    {
     }
 
-    template<typename A>
-    void basic_align_proxy<A>::tab()
+    template<typename O>
+    void basic_align<O>::reserve(unsigned columns, std::size_t head_len)
     {
-        // Complete I/O, needed by complete_column().
-        os_.flush();
+        widths_.reserve(columns);
+        if (heads_.size() < columns)
+            heads_.resize(columns);
+        for (unsigned i = 0; i < columns; ++i)
+            heads_[i].reserve(head_len);
+    }
 
-        // Pad until end of column.
-        complete_column();
+    template<typename O>
+    void basic_align<O>::widen(unsigned col, unsigned width)
+    {
+        fit(col, width);
+    }
 
-        // Update cursor.
-        os_.flush();
+    template<typename O>
+    template<typename InputIt>
+    void basic_align<O>::widen(InputIt first, InputIt last)
+    {
+        for (unsigned col = 0; first != last; ++first, ++col)
+            widen(col, *first);
+    }
 
-        // Move the cursors forward.
-        at_begin_ = false;
-        last_pos_ = cursor_;
+    template<typename O>
+    inline const std::vector<int>& basic_align<O>::widths() const
+    {
+        return widths_;
     }
 
-    template<typename A>
-    void basic_align_proxy<A>::next()
+    template<typename O>
+    inline unsigned basic_align<O>::columns() const
     {
-        if (col_ + 1 < a_.widths_.size())
-            tab();
-        else
-            endr();
+        return widths_.size();
     }
 
-    template<typename A>
-    void basic_align_proxy<A>::hline()
+    template<typename O>
+    inline int basic_align<O>::width(unsigned col) const
     {
-        if (col_ + 1 < a_.widths_.size())
-        {
-            if (!at_column_start())
-                complete_column();
+        return col < widths_.size() ? widths_[col] : 0;
+    }
 
-            // Fill the remainder of the row with a rule.
-            for (unsigned i = col_; i < a_.widths_.size(); ++i)
-            {
-                for (unsigned j = 0; j < a_.widths_[i]; ++j)
-                    os_ << rule_char_;
-                if (i + 1 < a_.widths_.size())
-                    os_ << sep_char_;
-            }
+    template<typename O>
+    void basic_align<O>::setmaxwidth(unsigned width)
+    {
+        maxwidth_ = width;
+        cap_widths();
+    }
 
-            complete_row();
+    template<typename O>
+    void basic_align<O>::setmaxwidth(unsigned col, unsigned width)
+    {
+        if (col >= maxwidths_.size())
+            maxwidths_.resize(col + 1, -1);
+        maxwidths_[col] = width;
+        cap_widths();
+    }
+
+    template<typename O>
+    void basic_align<O>::clearmaxwidth(unsigned col)
+    {
+        if (col < maxwidths_.size())
+            maxwidths_[col] = -1;
+        cap_widths();
+    }
+
+    template<typename O>
+    inline int basic_align<O>::maxwidth(unsigned col) const
+    {
+        return col < maxwidths_.size() && maxwidths_[col] >= 0 ? maxwidths_[col] : maxwidth_;
+    }
+
+    template<typename O>
+    void basic_align<O>::cap_widths()
+    {
+        // Narrow the columns already wider than their new limit.
+        for (unsigned i = 0; i < widths_.size(); ++i)
+        {
+            int m = maxwidth(i);
+            if (m && widths_[i] > m)
+                widths_[i] = m;
         }
-        else
-            endr();
     }
 
-    template<typename A>
-    void basic_align_proxy<A>::heads()
+    template<typename O>
+    inline int basic_align<O>::fit(unsigned col, int width)
     {
-        if (col_ + 1 < a_.widths_.size())
+        if (col >= widths_.size())
+            widths_.resize(col + 1);
+        if (width > widths_[col])
         {
-            if (!at_column_start())
-                complete_column();
+            int m = maxwidth(col);
+            widths_[col] = (m && width > m) ? m : width;
+        }
+        return widths_[col];
+    }
 
-            // Print out the headers.
-            for (unsigned i = col_; i < a_.heads_.size(); ++i)
-            {
-                os_ << a_.heads_[i];
-                if (i + 1 < a_.heads_.size())
-                {
-                    for (unsigned j = 0; j < a_.widths_[i] - a_.heads_[i].size(); ++j)
-                        os_ << fill_char_;
-                    os_ << sep_char_;
-                }
-            }
-            complete_row();
+    template<typename O>
+    inline void basic_align<O>::clear_widths()
+    {
+        widths_.clear();
+    }
+
+    template<typename O>
+    inline unsigned basic_align<O>::nheads() const
+    {
+        return nheads_;
+    }
+
+    template<typename O>
+    inline const typename basic_align<O>::string_type&
+    basic_align<O>::head(unsigned col) const
+    {
+        return heads_[col];
+    }
+
+    template<typename O>
+    void basic_align<O>::set_head(unsigned col, const char_type* s, std::size_t n)
+    {
+        // Clear the slots skipped since the last reset.
+        if (col >= heads_.size())
+            heads_.resize(col + 1);
+        for (; nheads_ <= col; ++nheads_)
+            heads_[nheads_].clear();
+        heads_[col].assign(s, n);
+    }
+
+    template<typename O>
+    inline void basic_align<O>::clear_heads()
+    {
+        nheads_ = 0;
+    }
+
+    template<typename O, unsigned N>
+    typename basic_static_align<O, N>::proxy_type
+    basic_static_align<O, N>::attach(O& os,
+                                     typename O::char_type f,
+                                     typename O::char_type s,
+                                     typename O::char_type r,
+                                     typename O::char_type t)
+    {
+        return proxy_type(os, *this, f, s, r, t);
+    }
+
+    template<typename O, unsigned N>
+    basic_static_align<O, N>::basic_static_align()
+        : nheads_(0), maxwidth_(0)
+    {
+        for (unsigned i = 0; i < N; ++i)
+        {
+            initial_[i] = widths_[i] = 0;
+            maxwidths_[i] = -1;
         }
-        else
-            endr();
     }
 
-    template<typename A>
-    void
-    basic_align_proxy<A>::sethead(const typename basic_align_proxy<A>::char_type* s,
-                                  unsigned w, size_type len)
+    template<typename O, unsigned N>
+    basic_static_align<O, N>::basic_static_align(const int (&widths)[N])
+        : nheads_(0), maxwidth_(0)
     {
-        // Place the label in the heads array.
-        if (col_ >= a_.heads_.size())
-            a_.heads_.resize(col_ + 1);
+        for (unsigned i = 0; i < N; ++i)
+        {
+            initial_[i] = widths_[i] = widths[i];
+            maxwidths_[i] = -1;
+        }
+    }
 
-        if (len != string_type::npos)
-            a_.heads_[col_].assign(s, len);
-        else
-            a_.heads_[col_].assign(s);
+    template<typename O, unsigned N>
+    inline void basic_static_align<O, N>::widen(unsigned col, unsigned width)
+    {
+        fit(col, width);
+    }
 
-        size_type clen = w > a_.heads_[col_].size() ? w : a_.heads_[col_].size();
-        // Now adjust the widths.
-        if (col_ >= a_.widths_.size())
-            a_.widths_.resize(col_ + 1);
-        if (clen > a_.widths_[col_])
-            a_.widths_[col_] = clen;
+    template<typename O, unsigned N>
+    template<typename InputIt>
+    void basic_static_align<O, N>::widen(InputIt first, InputIt last)
+    {
+        for (unsigned col = 0; first != last && col < N; ++first, ++col)
+            fit(col, *first);
+    }
 
-        // fprintf(debug, "HAI head:%s:%d:\n", a_.heads_[col_].c_str(), (int)a_.widths_[col_]);
+    template<typename O, unsigned N>
+    void basic_static_align<O, N>::setmaxwidth(unsigned width)
+    {
+        maxwidth_ = width;
+        cap_widths();
+    }
 
-        // Adjust column.
-        ++col_;
+    template<typename O, unsigned N>
+    void basic_static_align<O, N>::setmaxwidth(unsigned col, unsigned width)
+    {
+        if (col < N)
+            maxwidths_[col] = width;
+        cap_widths();
     }
 
-    template<typename A>
-    void
-    basic_align_proxy<A>::rawheads(const typename basic_align_proxy<A>::char_type* s)
+    template<typename O, unsigned N>
+    void basic_static_align<O, N>::clearmaxwidth(unsigned col)
+    {
+        if (col < N)
+            maxwidths_[col] = -1;
+        cap_widths();
+    }
+
+    template<typename O, unsigned N>
+    void basic_static_align<O, N>::cap_widths()
+    {
+        for (unsigned i = 0; i < N; ++i)
+        {
+            int m = maxwidth(i);
+            if (m && widths_[i] > m)
+                widths_[i] = m;
+        }
+    }
+
+    template<typename O, unsigned N>
+    inline int basic_static_align<O, N>::fit(unsigned col, int width)
     {
-        size_type i, laststart;
+        // Cells beyond the last column are not padded.
+        if (col >= N)
+            return width;
+        if (width > widths_[col])
+        {
+            int m = maxwidth(col);
+            widths_[col] = (m && width > m) ? m : width;
+        }
+        return widths_[col];
+    }
+
+    template<typename O, unsigned N>
+    inline void basic_static_align<O, N>::clear_widths()
+    {
+        for (unsigned i = 0; i < N; ++i)
+            widths_[i] = initial_[i];
+        cap_widths();
+    }
+
+    template<typename O, unsigned N>
+    void basic_static_align<O, N>::set_head(unsigned col, const char_type* s, std::size_t n)
+    {
+        // Titles beyond the last column are dropped.
+        if (col >= N)
+            return;
+        for (; nheads_ <= col; ++nheads_)
+            heads_[nheads_].clear();
+        heads_[col].assign(s, n);
+    }
+
+#if __cplusplus >= 201103L
+    // Collects the rows of one writer and publishes them to the
+    // queue. Only complete rows are published, so that the rows of
+    // different threads are never mixed up.
+    template<typename O>
+    class basic_shared_align<O>::row_sink
+        : public std::basic_streambuf<typename O::char_type, typename O::traits_type>
+    {
+    public:
+        typedef typename O::traits_type::int_type int_type;
+
+        explicit row_sink(basic_shared_align& a) : a_(a), rows_() {}
+
+        ~row_sink()
+        {
+            publish(true);
+            a_.drain();
+        }
+
+    protected:
+        virtual int_type overflow(int_type c)
+        {
+            if (traits_type::eq_int_type(c, traits_type::eof()))
+                return traits_type::not_eof(c);
+            char_type ch = traits_type::to_char_type(c);
+            rows_ += ch;
+            if (traits_type::eq(ch, '\n'))
+                completed();
+            return c;
+        }
+
+        virtual std::streamsize xsputn(const char_type* s, std::streamsize n)
+        {
+            rows_.append(s, n);
+            if (n > 0 && traits_type::eq(s[n - 1], '\n'))
+                completed();
+            return n;
+        }
+
+        virtual int sync()
+        {
+            publish(false);
+            a_.flush();
+            return 0;
+        }
+
+    private:
+        row_sink(const row_sink&);
+        row_sink& operator=(const row_sink&);
+
+        enum { batch_size = 4096 };
+
+        void completed()
+        {
+            if (a_.ordered_ || rows_.size() >= batch_size)
+            {
+                publish(false);
+                a_.drain();
+            }
+        }
 
-        for (laststart = 0, i = 0; s[i] != '\0'; ++i)
+        // Publish the complete rows, or everything if `all`.
+        void publish(bool all)
         {
-            if (s[i] != tab_char_ && s[i] != '\n')
-                continue;
+            std::size_t n = rows_.size();
+            if (!all)
+            {
+                std::size_t nl = rows_.rfind(char_type('\n'));
+                n = (nl == string_type::npos) ? 0 : nl + 1;
+            }
+            if (n == 0)
+                return;
+            if (n == rows_.size())
+                a_.push(rows_);
+            else
+            {
+                // Keep the start of the current row.
+                string_type rest(rows_, n);
+                rows_.resize(n);
+                a_.push(rows_);
+                rows_.assign(rest);
+            }
+        }
 
-            sethead(s + laststart, i - laststart, i - laststart);
+        basic_shared_align& a_;
+        string_type         rows_;
+    };
 
-            if (s[i] == '\n')
-                endr();
+    // Members of writer constructed before its basic_align_proxy base.
+    template<typename O>
+    struct basic_shared_align<O>::writer_base
+    {
+        row_sink    sink;
+        stream_type stream;
 
-            laststart = i + 1;
+        explicit writer_base(basic_shared_align& a)
+            : sink(a), stream(&sink)
+        {
+            stream.imbue(a.os_.getloc());
         }
-        if (i > laststart)
-            sethead(s + laststart, i - laststart, i - laststart);
-    }
+    };
 
-    template<typename A>
-    void
-    basic_align_proxy<A>::raw(const typename basic_align_proxy<A>::char_type* s)
+    /** @brief Output proxy for one thread printing to a basic_shared_align.
+     *
+     * A writer is used like the proxy returned by basic_align::attach,
+     * with row buffering always on. The rows are published when they
+     * are completed, when the writer is flushed and when it is
+     * destroyed; the end of an incomplete row is published last.
+     */
+    template<typename O>
+    class basic_shared_align<O>::writer
+        : private basic_shared_align<O>::writer_base,
+          public basic_shared_align<O>::proxy_type
     {
-        size_type i, laststart;
-
-        for (laststart = 0, i = 0; s[i] != '\0'; ++i)
+    public:
+        explicit writer(basic_shared_align& a,
+                        char_type fill_char = ' ',
+                        char_type sep_char = ' ',
+                        char_type rule_char = '-',
+                        char_type tab_char = '\t')
+            : writer_base(a),
+              proxy_type(this->stream, a, fill_char, sep_char, rule_char, tab_char)
         {
-            if (s[i] != tab_char_ && s[i] != '\n')
-                continue;
-
-            os_.write(s + laststart, i - laststart);
+            this->setrowbuf(true);
+        }
 
-            if (s[i] == '\n')
-                endr();
-            else
-                tab();
+    private:
+        writer(const writer&);
+        writer& operator=(const writer&);
+    };
 
-            laststart = i + 1;
-        }
-        if (i > laststart)
-            os_.write(s + laststart, i - laststart);
+    template<typename O>
+    basic_shared_align<O>::basic_shared_align(O& os, unsigned columns,
+                                              bool ordered, std::size_t queue_size)
+        : os_(os), ordered_(ordered),
+          widths_(columns), ncols_(0),
+          heads_(columns), nheads_(0),
+          maxwidths_(columns, -1), maxwidth_(0),
+          slots_(), mask_(0), tail_(0), head_(0), busy_(false)
+    {
+        for (unsigned i = 0; i < columns; ++i)
+            widths_[i].store(0, std::memory_order_relaxed);
+
+        // The queue size is rounded up to a power of two.
+        std::size_t n = 1;
+        while (n < queue_size)
+            n <<= 1;
+        std::vector<slot>(n).swap(slots_);
+        mask_ = n - 1;
+        for (std::size_t i = 0; i < n; ++i)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    hline(basic_align_proxy<A>& os)
+    template<typename O>
+    basic_shared_align<O>::~basic_shared_align()
     {
-        os.hline();
-        return os;
+        flush();
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    endr(basic_align_proxy<A>& os)
+    template<typename O>
+    inline void basic_shared_align<O>::widen(unsigned col, unsigned width)
     {
-        os.endr();
-        return os;
+        fit(col, width);
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    tab(basic_align_proxy<A>& os)
+    template<typename O>
+    template<typename InputIt>
+    void basic_shared_align<O>::widen(InputIt first, InputIt last)
     {
-        os.tab();
-        return os;
+        for (unsigned col = 0; first != last; ++first, ++col)
+            fit(col, *first);
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    next(basic_align_proxy<A>& os)
+    template<typename O>
+    void basic_shared_align<O>::setmaxwidth(unsigned width)
     {
-        os.next();
-        return os;
+        maxwidth_ = width;
+        cap_widths();
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    reset(basic_align_proxy<A>& os)
+    template<typename O>
+    void basic_shared_align<O>::setmaxwidth(unsigned col, unsigned width)
     {
-        os.reset();
-        return os;
+        if (col < maxwidths_.size())
+            maxwidths_[col] = width;
+        cap_widths();
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    resetheads(basic_align_proxy<A>& os)
+    template<typename O>
+    void basic_shared_align<O>::clearmaxwidth(unsigned col)
     {
-        os.resetheads();
-        return os;
+        if (col < maxwidths_.size())
+            maxwidths_[col] = -1;
+        cap_widths();
     }
 
-
-    template<typename A>
-    inline basic_align_proxy<A>&
-    heads(basic_align_proxy<A>& os)
+    template<typename O>
+    void basic_shared_align<O>::cap_widths()
     {
-        os.heads();
-        return os;
+        for (unsigned i = 0; i < widths_.size(); ++i)
+        {
+            int m = maxwidth(i);
+            if (m && widths_[i].load(std::memory_order_relaxed) > m)
+                widths_[i].store(m, std::memory_order_relaxed);
+        }
     }
 
-    template<typename Char>
-    class sethead_ {
-        const Char* s_;
-        unsigned w_;
-
-        template<typename A>
-        friend class basic_align_proxy;
-
-    public:
-        sethead_(const Char* s, unsigned w) : s_(s), w_(w) {}
-    };
-
-    template<typename Char>
-    inline sethead_<Char>
-    head(const Char* s, unsigned width)
+    template<typename O>
+    inline int basic_shared_align<O>::fit(unsigned col, int width)
     {
-        return sethead_<Char>(s, width);
+        // Cells beyond the last column are not padded.
+        if (col >= widths_.size())
+            return width;
+        int m = maxwidth(col);
+        if (m && width > m)
+            width = m;
+
+        // The widths only grow, so once a column is wide enough this
+        // only reads shared state.
+        std::atomic<int>& w = widths_[col];
+        int cur = w.load(std::memory_order_relaxed);
+        while (width > cur && !w.compare_exchange_weak(cur, width, std::memory_order_relaxed))
+            ;
+        unsigned n = ncols_.load(std::memory_order_relaxed);
+        while (col >= n && !ncols_.compare_exchange_weak(n, col + 1, std::memory_order_relaxed))
+            ;
+        return width > cur ? width : cur;
     }
-    template<typename Char, typename Traits>
-    inline sethead_<Char>
-    head(const std::basic_string<Char, Traits>& s, unsigned width)
+
+    template<typename O>
+    void basic_shared_align<O>::clear_widths()
     {
-        return sethead_<Char>(s.c_str(), width);
+        for (std::size_t i = 0; i < widths_.size(); ++i)
+            widths_[i].store(0, std::memory_order_relaxed);
+        ncols_.store(0, std::memory_order_relaxed);
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    basic_align_proxy<A>::operator<<(const sethead_<typename basic_align_proxy<A>::char_type>& h)
+    template<typename O>
+    void basic_shared_align<O>::set_head(unsigned col, const char_type* s, std::size_t n)
     {
-        sethead(h.s_, h.w_);
-        return *this;
+        // Titles beyond the last column are dropped.
+        if (col >= heads_.size())
+            return;
+        for (; nheads_ <= col; ++nheads_)
+            heads_[nheads_].clear();
+        heads_[col].assign(s, n);
     }
 
-
-    template<typename Char, bool heads>
-    class raw_ {
-        const Char* s_;
-
-        template<typename A>
-        friend class basic_align_proxy;
-
-    public:
-        raw_(const Char* s) : s_(s) {}
-    };
-
-    template<typename Char>
-    inline raw_<Char, false>
-    raw(const Char *s)
+    template<typename O>
+    bool basic_shared_align<O>::try_push(string_type& text)
     {
-        return raw_<Char, false>(s);
+        // Claim the next position, then fill its slot. A slot is free
+        // for position pos when its sequence number is pos.
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            slot& sl = slots_[pos & mask_];
+            std::size_t seq = sl.seq.load(std::memory_order_acquire);
+            std::ptrdiff_t d = (std::ptrdiff_t)(seq - pos);
+            if (d == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    // Take the slot's cleared string in exchange,
+                    // so that its storage is reused.
+                    sl.text.swap(text);
+                    sl.seq.store(pos + 1);
+                    return true;
+                }
+            }
+            else if (d < 0)
+                return false; // full
+            else
+                pos = tail_.load(std::memory_order_relaxed);
+        }
     }
-    template<typename Char, typename Traits>
-    inline raw_<Char, false>
-    raw(const std::basic_string<Char, Traits>& s)
+
+    template<typename O>
+    void basic_shared_align<O>::push(string_type& text)
     {
-        return raw_<Char, false>(s.c_str());
+        while (!try_push(text))
+        {
+            drain();
+            std::this_thread::yield();
+        }
     }
-    template<typename Char>
-    inline raw_<Char, true>
-    rawheads(const Char *s)
+
+    template<typename O>
+    inline bool basic_shared_align<O>::ready() const
     {
-        return raw_<Char, true>(s);
+        std::size_t h = head_.load();
+        return slots_[h & mask_].seq.load() == h + 1;
     }
-    template<typename Char, typename Traits>
-    inline raw_<Char, true>
-    rawheads(const std::basic_string<Char, Traits>& s)
+
+    template<typename O>
+    void basic_shared_align<O>::write_out()
     {
-        return raw_<Char, true>(s.c_str());
+        // Only called by the thread that set busy_.
+        std::size_t h = head_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            slot& sl = slots_[h & mask_];
+            if (sl.seq.load(std::memory_order_acquire) != h + 1)
+                break;
+            os_.write(sl.text.data(), sl.text.size());
+            sl.text.clear();
+            sl.seq.store(h + mask_ + 1, std::memory_order_release);
+            head_.store(++h);
+        }
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    basic_align_proxy<A>::operator<<(const raw_<typename basic_align_proxy<A>::char_type, false>& r)
+    template<typename O>
+    void basic_shared_align<O>::drain()
     {
-        raw(r.s_);
-        return *this;
+        // A thread that publishes a row while another one writes out
+        // leaves the row to it. The sequentially consistent
+        // operations ensure that the other thread then sees the row
+        // when it checks again after clearing busy_.
+        while (ready() && !busy_.exchange(true))
+        {
+            write_out();
+            busy_.store(false);
+        }
     }
-    template<typename A>
-    inline basic_align_proxy<A>&
-    basic_align_proxy<A>::operator<<(const raw_<typename basic_align_proxy<A>::char_type, true>& r)
+
+    template<typename O>
+    void basic_shared_align<O>::flush()
     {
-        rawheads(r.s_);
-        return *this;
+        while (busy_.exchange(true))
+            std::this_thread::yield();
+        write_out();
+        os_.flush();
+        busy_.store(false);
+        drain();
     }
+#endif
 
-
-    template<typename Pos, typename Char, typename State>
-    class ocounter: public std::codecvt<Char, Char, State>
+    namespace detail
     {
-    public:
-        ocounter(Pos& count) : count_(&count) {}
-    private:
-        typedef std::codecvt<Char,Char,State> parent;
-        typedef typename parent::result       result;
-
-        virtual bool do_always_noconv() const throw()
-        {
-            return false;
-        }
-        virtual result do_out (State& state,
-                               const Char* fr, const Char* fe, const Char*& fn,
-                               Char*       to, Char*       te, Char*&       tn) const
+        template<typename Char>
+        void measure(const Char* s, const Char* e, const raw_splitter<Char>& split,
+                     std::vector<int>& widths, unsigned flags)
         {
-            (*count_) += (fe - fr);
-            return parent::do_out(state, fr, fe, fn, to, te, tn);
-        }
-
-        Pos* count_;
-    };
-
+            unsigned col = 0;
 
+            s = split.start(s, e);
+            for (;;)
+            {
+                const Char* c = s;
+                const Char* d;
+                raw_boundary b = split.next(s, e, d);
 
-    template<typename Align>
-    basic_align_proxy<Align>::basic_align_proxy(typename Align::stream_type& os, Align& a,
-                                                typename basic_align_proxy<Align>::char_type f,
-                                                typename basic_align_proxy<Align>::char_type s,
-                                                typename basic_align_proxy<Align>::char_type r,
-                                                typename basic_align_proxy<Align>::char_type t)
-        : os_(os), a_(a), col_(0), cursor_(0),
-          last_pos_(0),
-          at_begin_(true),
-          prev_locale_(os.imbue(std::locale(os.getloc(),
-                                            new ocounter<pos_type, char_type,
-                                            typename stream_type::traits_type::state_type>(cursor_)))),
-          fill_char_(f),
-          sep_char_(s),
-          rule_char_(r),
-          tab_char_(t)
-    {
+                // Like the proxy, count every cell except that of an
+                // empty row.
+                if (d > c || col > 0 || b == raw_tab)
+                {
+                    if (col >= widths.size())
+                        widths.resize(col + 1);
+                    int w = text_width(c, d, flags);
+                    if (w > widths[col])
+                        widths[col] = w;
+                }
+                if (b == raw_end)
+                    break;
+                if (b == raw_row)
+                {
+                    col = 0;
+                    s = split.start(s, e);
+                }
+                else
+                    ++col;
+            }
+        }
     }
 
-    template<typename Align>
-    basic_align_proxy<Align>::~basic_align_proxy()
+    template<typename Char>
+    void measure(const Char* s, std::size_t n, Char tab, std::vector<int>& widths,
+                 unsigned flags)
     {
-        os_.imbue(prev_locale_);
+        detail::measure(s, s + n, detail::raw_splitter<Char>(&tab, 1), widths, flags);
     }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    operator<<(basic_align_proxy<A>& s,
-               typename A::stream_type& (*op)(typename A::stream_type&))
+    template<typename Char>
+    void measure(const Char* s, std::size_t n, const Char* sep, std::vector<int>& widths,
+                 unsigned flags)
     {
-        op(s.os_);
-        return s;
-    };
+        std::size_t len = std::char_traits<Char>::length(sep);
+        detail::measure(s, s + n, detail::raw_splitter<Char>(sep, len), widths, flags);
+    }
 
-    template<typename A>
-    inline basic_align_proxy<A>&
-    operator<<(basic_align_proxy<A>& s,
-               basic_align_proxy<A>& (*op)(basic_align_proxy<A>&))
+    template<typename Char, typename Align>
+    void measure_extent(const Char* s, std::size_t n, const Char* sep, const Align& a,
+                        unsigned flags, cap_mode mode, const Char* marker, raw_extent& x)
     {
-        return op(s);
-    };
+        const detail::raw_splitter<Char> split(sep, std::char_traits<Char>::length(sep));
+        std::basic_string<Char> mark;
+        if (marker)
+            mark.assign(marker);
+        else
+            mark.assign(3, Char('.'));
+        const std::size_t mw = detail::text_width(mark.data(), mark.data() + mark.size(), flags);
+        std::basic_string<Char> cut;
+
+        const Char* e = s + n;
+        unsigned col = 0;
+        s = split.start(s, e);
+        for (;;)
+        {
+            const Char* c = s;
+            const Char* d;
+            detail::raw_boundary b = split.next(s, e, d);
 
+            // Like the proxy, print every cell except that of an
+            // empty row.
+            if (d > c || col > 0 || b == detail::raw_tab)
+            {
+                if (col >= x.widths.size())
+                {
+                    x.widths.resize(col + 1);
+                    x.padded.resize(col + 1);
+                    x.filled.resize(col + 1);
+                }
+                std::size_t w = detail::text_width(c, d, flags);
+                if ((int)w > x.widths[col])
+                    x.widths[col] = w;
+
+                // Cut the cell as basic_align_proxy::cap_cell does. A
+                // wider cell that is not cut only fills its column.
+                std::size_t len = d - c;
+                std::size_t m = a.maxwidth(col);
+                if (m && w > m)
+                {
+                    if (mode == cap_overflow)
+                        w = m;
+                    else
+                    {
+                        bool elide = (mode == cap_elide && mw <= m);
+                        len = detail::fit_prefix(c, d, flags, m - (elide ? mw : 0), w);
+                        if (flags & width_ansi)
+                        {
+                            cut.clear();
+                            detail::append_escapes(c + len, d, cut);
+                            len += cut.size();
+                        }
+                        if (elide)
+                        {
+                            len += mark.size();
+                            w += mw;
+                        }
+                    }
+                }
 
-    template<typename A>
-    template<typename T>
-    basic_align_proxy<A>&
-    basic_align_proxy<A>::operator<<(const T& t)
-    {
-        os_ << t;
-        return *this;
+                // The text, then a separator or the newline.
+                x.chars += len + 1;
+                if (b == detail::raw_tab)
+                {
+                    ++x.padded[col];
+                    x.filled[col] += w;
+                }
+            }
+            if (b == detail::raw_end)
+                break;
+            if (b == detail::raw_row)
+            {
+                col = 0;
+                s = split.start(s, e);
+            }
+            else
+                ++col;
+        }
     }
 
-    template<typename O>
-    typename basic_align<O>::proxy_type
-    basic_align<O>::attach(O& os,
-                           typename O::char_type f,
-                           typename O::char_type s,
-                           typename O::char_type r,
-                           typename O::char_type t)
+    template<typename Char>
+    void measure_csv(const Char* s, std::size_t n, Char sep, std::vector<int>& widths,
+                     unsigned flags)
     {
-        return proxy_type(os, *this, f, s, r, t);
-    }
+        const Char nl = '\n';
+        const Char* e = s + n;
+        std::basic_string<Char> cell;
+        unsigned col = 0;
 
-    template<typename O>
-    basic_align<O>::basic_align()
-        : widths_(), heads_()
-    {
+        for (;;)
+        {
+            bool quoted = false;
+            const Char* d = detail::find_csv(s, e, sep, quoted);
+            const Char* t = (d != e && *d == nl && d > s && d[-1] == '\r') ? d - 1 : d;
+
+            // Like the proxy, count every cell except that of an
+            // empty row.
+            if (t > s || col > 0 || (d != e && *d == sep))
+            {
+                if (col >= widths.size())
+                    widths.resize(col + 1);
+                int w;
+                if (std::find(s, t, Char('"')) == t)
+                    w = detail::text_width(s, t, flags);
+                else
+                {
+                    cell.clear();
+                    detail::csv_unquote(s, t, detail::csv_plain, cell);
+                    w = detail::text_width(cell.data(), cell.data() + cell.size(), flags);
+                }
+                if (w > widths[col])
+                    widths[col] = w;
+            }
+            if (d == e)
+                break;
+            col = (*d == nl) ? 0 : col + 1;
+            s = d + 1;
+        }
     }
 
     /// @endcond
@@ -19,13 +19,27 @@
 // IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 // CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "ioalign.h"
+#include "pipeline.h"
+#include "writev_buf.h"
+#include "follow.h"
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
+#include <getopt.h>
 
 using namespace std;
 
@@ -45,7 +59,13 @@ void usage(std::ostream& o, const char *pname)
         "These special prefixes are configurable (-R/-H/-C)."
         "\n"
         "Options:\n"
-        " -t C    Set the input tab character to C. (default: tab)\n"
+        " -t STR  Set the input separator to STR, which may have several\n"
+        "         characters. (default: tab)\n"
+        " -b      Split input columns on runs of spaces and tabs, ignoring\n"
+        "         them at the start and end of rows.\n"
+        " -c      Read the input as CSV, with cells in double quotes\n"
+        "         possibly holding separators, newlines and doubled quotes.\n"
+        "         The separator (-t) must be one character. (default: ,)\n"
         " -f C    Set the output fill character to C. (default: space)\n"
         " -s C    Set the output separator to C. (default: space)\n"
         " -r C    Set the output horizontal rule character to C. (default: -)\n"
@@ -57,6 +77,36 @@ void usage(std::ostream& o, const char *pname)
         " -R C    Set the special row prefix for rules. (default: =)\n"
         " -C C    Set the special row prefix for comments. (default: #)\n"
         " -H C    Set the special row prefix for titles. (default: ;)\n"
+        " -x      Scan the input first to compute the final column widths.\n"
+        "         The input must be a regular file.\n"
+        " -j N    Use N threads to scan the input. (default: number of CPUs)\n"
+        " -S      Read, format and write on a single thread, writing long\n"
+        "         cells of a regular input file without copying.\n"
+        " -P      Format chunks of the input on parallel threads and write\n"
+        "         each at its final offset. Implies -x. The input and output\n"
+        "         must be regular files; -p, -i, -c, -w and -W are not supported.\n"
+        " -F      Keep reading as the input file grows, like tail -f.\n"
+        " -L MS   With -F, print rows at most MS milliseconds after they\n"
+        "         arrive, writing the rows that arrive within that delay\n"
+        "         at once. (default: 100)\n"
+        " -B MODE Flush the output after each cell (cell), each row (row),\n"
+        "         every N rows (rows:N), every N bytes (bytes:N), at most N\n"
+        "         milliseconds after a row (ms:N), only at the end (never), or\n"
+        "         after each row on a terminal and only at the end otherwise\n"
+        "         (auto).\n"
+        "         (default: auto)\n"
+        " -w N    Hold up to N rows to widen columns before printing them.\n"
+        " -W N    Hold up to N bytes to widen columns before printing them.\n"
+        " -U      Measure columns by the display width of UTF-8 text.\n"
+        " -a      Do not count ANSI escape sequences, such as colors, in\n"
+        "         column widths.\n"
+        " -M N    Limit every column to N characters.\n"
+        " -M C:N  Limit column C (from 1) to N characters, or with 0 lift\n"
+        "         the limit of every column from it.\n"
+        " -m MODE Print wider cells in full (overflow), cut them (truncate)\n"
+        "         or cut them and end them with ... (elide). (default: elide)\n"
+        " --stats Print counts of the output and the time spent writing\n"
+        "         it to the standard error at exit.\n"
         " -h      Display this help.\n"
         " -V      Display version information and exit.\n"
         "\n"
@@ -71,22 +121,860 @@ void version(std::ostream& o)
     exit(0);
 }
 
+struct options
+{
+    char f; // fill character
+    char s; // column separator
+    char r; // horizontal rule
+    const char *t; // column separator for input, or "" for runs of blanks
+    bool csv; // whether the input is CSV
+    char R; // input prefix for hline
+    char C; // input prefix for comments
+    char H; // input prefix for titles
+    bool paginate; // whether to repeat column headers at intervals
+    int max_lines_per_page; // number of lines per interval
+    bool special; // whether to interpret special prefixes
+    char *headtext; // default column headers
+    bool underline_heads; // whether to produce a rule underneath titles
+    const char *iname; // input file
+    const char *oname; // output file
+    bool exact; // whether to pre-scan the input for column widths
+    unsigned jobs; // number of threads for the pre-scan
+    bool single; // whether to read, format and write on one thread
+    bool parallel; // whether to format chunks of the input in parallel
+    unsigned window_rows; // number of rows to look ahead
+    size_t window_bytes; // number of bytes to look ahead
+    bool follow; // whether to keep reading as the input grows
+    int latency; // longest delay before printing a followed row, in ms
+    io::flush_policy flush; // when to flush the output
+    unsigned long flush_n; // rows, bytes or milliseconds between flushes
+    int out_fd; // output file descriptor, or -1
+    struct run_stats *stats; // what to count for --stats, or NULL
+    unsigned width; // how to count column widths (io::width_flags)
+    unsigned max_width; // limit on every column width, or 0
+    vector<pair<unsigned, unsigned> > max_widths; // limits on given columns
+    io::cap_mode cap; // how to print cells wider than their limit
+
+    options()
+        : f(' '), s(' '), r('-'), t("\t"), csv(false), R('='), C('#'), H(';'),
+          paginate(false), max_lines_per_page(25), special(false),
+          headtext(NULL), underline_heads(false),
+          iname("/dev/stdin"), oname("/dev/stdout"),
+          exact(false), jobs(0), single(false), parallel(false), window_rows(0), window_bytes(0),
+          follow(false), latency(100),
+          flush(io::flush_auto), flush_n(1), out_fd(-1), stats(NULL),
+          width(io::width_bytes), max_width(0), max_widths(), cap(io::cap_elide)
+    {}
+
+private:
+    options(const options&);
+    options& operator=(const options&);
+};
+
+// Counts for --stats.
+struct run_stats
+{
+    io::align_stats out;
+    chrono::steady_clock::duration write_time; // in write calls, on all threads
+
+    run_stats() : out(), write_time(0) {}
+};
+
+// Print the counts to the standard error.
+static void print_stats(const run_stats& s, chrono::steady_clock::duration elapsed)
+{
+    const io::align_stats& a = s.out;
+    unsigned long long total = a.payload + a.padding + a.rule_chars + a.separators;
+    double pct = total ? 100.0 / total : 0;
+    ostringstream os;
+    os.setf(ios::fixed);
+    os.precision(1);
+    os << "align: " << a.rows << " rows (" << a.heads << " title rows, "
+       << a.rules << " rules), " << a.cells << " cells\n"
+       << "align: " << total << " bytes: " << a.payload << " text (" << a.payload * pct
+       << "%), " << a.padding << " padding (" << a.padding * pct << "%), "
+       << a.rule_chars << " rules (" << a.rule_chars * pct << "%), "
+       << a.separators << " separators (" << a.separators * pct << "%)\n"
+       << "align: " << a.flushes << " flushes\n"
+       << "align: columns widened:";
+    for (size_t i = 0; i < a.widened.size(); ++i)
+        if (a.widened[i])
+            os << ' ' << i + 1 << ':' << a.widened[i];
+    os.precision(3);
+    os << "\nalign: " << chrono::duration<double>(elapsed).count() << " s elapsed, "
+       << chrono::duration<double>(s.write_time).count() << " s in write calls\n";
+    cerr << os.str() << flush;
+}
+
+// Prints the counts for --stats, if enabled, when it goes out of scope.
+class stats_report
+{
+public:
+    stats_report() : stats_(), start_(chrono::steady_clock::now()), on_(false) {}
+    ~stats_report()
+    {
+        if (on_)
+            print_stats(stats_, chrono::steady_clock::now() - start_);
+    }
+    run_stats *enable() { on_ = true; return &stats_; }
+private:
+    run_stats                         stats_;
+    chrono::steady_clock::time_point  start_;
+    bool                              on_;
+};
+
+// Apply the column width limits to a table.
+static void limit_widths(io::align& table, const options& o)
+{
+    table.setmaxwidth(o.max_width);
+    for (size_t i = 0; i < o.max_widths.size(); ++i)
+        table.setmaxwidth(o.max_widths[i].first, o.max_widths[i].second);
+}
+
+// How the proxy prints cells wider than their limit. Cutting cells
+// needs the row buffer, so it is only asked for when there are limits.
+static io::cap_mode cap_mode(const options& o)
+{
+    return (o.max_width || !o.max_widths.empty()) ? o.cap : io::cap_overflow;
+}
+
+// The text that ends elided cells.
+static const char *cap_marker(const options& o)
+{
+    return (o.width & io::width_utf8) ? "\xe2\x80\xa6" : "...";
+}
+
+// Set up a proxy for the output. Without rowbuf, cells are passed on
+// as they are parsed.
+static void setup_proxy(io::align_proxy& ap, const options& o, bool rowbuf = true)
+{
+    ap.setrawsep(o.t);
+    if (o.csv)
+        ap.setcsvsep(o.t[0]);
+    ap.setwidth(o.width);
+    ap.setflush(o.flush, o.flush_n, o.out_fd);
+    ap.setstats(o.stats ? &o.stats->out : NULL);
+    if (cap_mode(o) != io::cap_overflow)
+        ap.setoverflow(cap_mode(o), cap_marker(o));
+    ap.setrowbuf(rowbuf);
+}
+
+// Parse a flush policy given as a name, or as a name and N.
+static bool parse_flush(const char *arg, options& o)
+{
+    static const struct { const char *name; io::flush_policy policy; } names[] = {
+        { "never", io::flush_never }, { "cell", io::flush_cell },
+        { "row", io::flush_row }, { "auto", io::flush_auto },
+        { "rows:", io::flush_rows }, { "bytes:", io::flush_bytes },
+        { "ms:", io::flush_delay },
+    };
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; ++i)
+    {
+        size_t len = strlen(names[i].name);
+        if (strncmp(arg, names[i].name, len))
+            continue;
+        const char *rest = arg + len;
+        if (names[i].name[len - 1] != ':')
+        {
+            if (*rest)
+                continue;
+            o.flush_n = 1;
+        }
+        else
+        {
+            char *end;
+            o.flush_n = strtoul(rest, &end, 10);
+            if (end == rest || *end)
+                return false;
+        }
+        o.flush = names[i].policy;
+        return true;
+    }
+    return false;
+}
+
+// Parse a width limit given as N or C:N.
+static bool parse_max_width(const char *arg, options& o)
+{
+    char *end;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (end == arg)
+        return false;
+    if (*end == ':')
+    {
+        const char *w = end + 1;
+        unsigned long m = strtoul(w, &end, 10);
+        if (n == 0 || end == w || *end)
+            return false;
+        o.max_widths.push_back(make_pair((unsigned)n - 1, (unsigned)m));
+    }
+    else if (*end)
+        return false;
+    else
+        o.max_width = n;
+    return true;
+}
+
+// Read-only mapping of a regular input file.
+class mapped_file
+{
+public:
+    explicit mapped_file(const char *name);
+    ~mapped_file();
+
+    // Whether the file could be mapped.
+    bool ok() const { return ok_; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    mapped_file(const mapped_file&);
+    mapped_file& operator=(const mapped_file&);
+
+    bool        ok_;
+    const char *data_;
+    size_t      size_;
+};
+
+mapped_file::mapped_file(const char *name)
+    : ok_(false), data_(""), size_(0)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd == -1)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        if (st.st_size == 0)
+            ok_ = true;
+        else
+        {
+            void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED)
+            {
+                madvise(m, st.st_size, MADV_SEQUENTIAL);
+                ok_ = true;
+                data_ = (const char*)m;
+                size_ = st.st_size;
+            }
+        }
+    }
+    close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+    if (size_ > 0)
+        munmap((void*)data_, size_);
+}
+
+// Turns input rows into table rows, interpreting the special row
+// prefixes and pagination.
+class formatter
+{
+public:
+    formatter(io::align_proxy& ap, const options& o)
+        : ap_(ap), o_(o), line_num_(1) {}
+
+    // Produce the initial column titles, if any.
+    void start();
+
+    // Format one input row of n characters (without the newline).
+    void line(const char *line, size_t n);
+
+    // End the input. Returns false if it ends within a quoted CSV
+    // cell, whose row then ends there.
+    bool finish();
+
+private:
+    io::align_proxy& ap_;
+    const options&   o_;
+    int              line_num_; // current line on the page
+};
+
+void formatter::start()
+{
+    // If titles are given from the command line, start with that.
+    if (o_.headtext)
+    {
+        ap_.rawheads(o_.headtext);
+        ap_ << io::endr << io::heads;
+
+        line_num_ += 1;
+
+        if (o_.underline_heads)
+        {
+            ap_ << io::hline;
+            line_num_ += 1;
+        }
+    }
+}
+
+void formatter::line(const char *line, size_t n)
+{
+    if (o_.csv)
+    {
+        if (n > 0 && line[n - 1] == '\r')
+            --n;
+        if (ap_.inquotes())
+        {
+            // The line continues a quoted cell.
+            ap_.raw_csv("\n", 1);
+            ap_.raw_csv(line, n);
+            if (!ap_.inquotes())
+            {
+                ap_ << io::endr;
+                line_num_ += 1;
+            }
+            return;
+        }
+    }
+
+    if (o_.special && n > 0 && line[0] == o_.C)
+        return;
+
+    bool page_boundary = o_.paginate && line_num_ + 1 >= o_.max_lines_per_page;
+    bool head_prefix = o_.special && n > 0 && line[0] == o_.H;
+
+    if (page_boundary || head_prefix)
+    {
+        if (head_prefix)
+            ap_ << io::rawheads(line, n) << io::endr;
+
+        if (line_num_ > 1)
+            ap_ << ' ' << io::endr;
+
+        ap_ << io::heads;
+        line_num_ = 2;
+
+        if (o_.underline_heads)
+        {
+            ap_ << io::hline;
+            line_num_ += 1;
+        }
+
+        if (head_prefix)
+            return;
+    }
+
+    if (o_.special && n > 0 && line[0] == o_.R)
+        ap_ << io::hline;
+    else if (o_.csv)
+    {
+        ap_.raw_csv(line, n);
+        if (ap_.inquotes())
+            // The row continues on the next line.
+            return;
+        ap_ << io::endr;
+    }
+    else
+        ap_ << io::raw(line, n) << io::endr;
+    line_num_ += 1;
+}
+
+bool formatter::finish()
+{
+    if (!o_.csv || !ap_.inquotes())
+        return true;
+    ap_ << io::endr;
+    line_num_ += 1;
+    return false;
+}
+
+// Format the rows in [p, end). Like the getline() loop in main(),
+// this also visits the empty row after a final newline.
+static void format_rows(formatter& fmt, const char *p, const char *end, ostream& dout)
+{
+    while (dout.good())
+    {
+        const char *nl = (const char*)memchr(p, '\n', end - p);
+        fmt.line(p, (nl ? nl : end) - p);
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+}
+
+// Compute the column widths needed by the rows in [p, end).
+static void scan_widths(const options& o, const char *p, const char *end, vector<int>& widths)
+{
+    while (p < end)
+    {
+        const char *nl = (const char*)memchr(p, '\n', end - p);
+        size_t n = (nl ? nl : end) - p;
+
+        // Comments and rules do not contribute to widths.
+        if (!(o.special && n > 0 && (p[0] == o.C || p[0] == o.R)))
+            io::measure(p, n, o.t, widths, o.width);
+
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+}
+
+// Compute the column widths needed by the CSV rows in [p, end), where
+// a row continues past the end of a line within quotes.
+static void scan_csv_widths(const options& o, const char *p, const char *end, vector<int>& widths)
+{
+    const char *row = p;
+    bool quoted = false;
+    while (p < end)
+    {
+        const char *nl = (const char*)memchr(p, '\n', end - p);
+        const char *e = nl ? nl : end;
+
+        if (!quoted && o.special && e > p && (p[0] == o.C || p[0] == o.R))
+            row = e + 1;
+        else
+        {
+            quoted ^= count(p, e, '"') & 1;
+            if (!quoted)
+            {
+                io::measure_csv(row, (nl ? nl + 1 : end) - row, o.t[0], widths, o.width);
+                row = e + 1;
+            }
+        }
+
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+    if (quoted)
+        io::measure_csv(row, end - row, o.t[0], widths, o.width);
+}
+
+// The number of threads to use for parallel work.
+static unsigned thread_count(const options& o)
+{
+    unsigned n = o.jobs;
+    if (n == 0)
+        n = thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Run f(0) ... f(n - 1) on n threads, including the calling thread.
+template<typename F>
+void parallel_for(unsigned n, F f)
+{
+    vector<thread> workers;
+    for (unsigned i = 1; i < n; ++i)
+        workers.push_back(thread(f, i));
+    f(0);
+    for (unsigned i = 0; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+// Split the input into n chunks at row boundaries. Chunk i spans
+// [bounds[i], bounds[i + 1]).
+static vector<const char*> split_rows(const mapped_file& in, unsigned n)
+{
+    const char *begin = in.data(), *end = begin + in.size();
+    vector<const char*> bounds(1, begin);
+    for (unsigned i = 1; i < n; ++i)
+    {
+        const char *p = begin + in.size() / n * i;
+        if (p < bounds.back())
+            p = bounds.back();
+        const char *nl = (const char*)memchr(p, '\n', end - p);
+        bounds.push_back(nl ? nl + 1 : end);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+// Widen the columns of the titles from the command line, if any.
+static void widen_titles(io::align& table, const options& o)
+{
+    if (o.headtext)
+    {
+        vector<int> hw;
+        io::measure(o.headtext, strlen(o.headtext), o.t, hw, o.width);
+        table.widen(hw.begin(), hw.end());
+    }
+}
+
+// Widen the table to the final column widths of the input, scanning
+// chunks of the input in parallel.
+static void prescan(io::align& table, const options& o, const mapped_file& in)
+{
+    limit_widths(table, o);
+
+    // A chunk of CSV could start within quotes, so CSV is scanned
+    // on one thread.
+    unsigned n = o.csv ? 1 : thread_count(o);
+    vector<const char*> bounds = split_rows(in, n);
+
+    vector<vector<int> > widths(n);
+    parallel_for(n, [&](unsigned i) {
+            if (o.csv)
+                scan_csv_widths(o, bounds[i], bounds[i + 1], widths[i]);
+            else
+                scan_widths(o, bounds[i], bounds[i + 1], widths[i]);
+        });
+
+    for (unsigned i = 0; i < n; ++i)
+        table.widen(widths[i].begin(), widths[i].end());
+    widen_titles(table, o);
+}
+
+// Stream buffer that only counts the characters written to it.
+class count_buf : public streambuf
+{
+public:
+    count_buf() : count_(0) { setp(buf_, buf_ + sizeof buf_); }
+    streamoff count() const { return count_ + (pptr() - pbase()); }
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        count_ += pptr() - pbase();
+        setp(buf_, buf_ + sizeof buf_);
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+            ++count_;
+        return traits_type::not_eof(c);
+    }
+    virtual streamsize xsputn(const char *, streamsize n)
+    {
+        count_ += n;
+        return n;
+    }
+private:
+    streamoff count_;
+    char      buf_[4096];
+};
+
+// Stream buffer that writes to a file from a given offset onwards,
+// using pwrite() so that other threads can write elsewhere in the file.
+class pwrite_buf : public streambuf
+{
+public:
+    pwrite_buf(int fd, off_t offset)
+        : fd_(fd), off_(offset), buf_(1 << 20), failed_(false), write_time_(0)
+    {
+        setp(&buf_[0], &buf_[0] + buf_.size());
+    }
+    off_t offset() const { return off_ + (pptr() - pbase()); }
+    bool failed() const { return failed_; }
+    chrono::steady_clock::duration write_time() const { return write_time_; }
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        if (sync() != 0)
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    virtual int sync()
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (char *p = pbase(); !failed_ && p < pptr(); )
+        {
+            ssize_t r = pwrite(fd_, p, pptr() - p, off_);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                failed_ = true;
+            else
+            {
+                p += r;
+                off_ += r;
+            }
+        }
+        write_time_ += chrono::steady_clock::now() - start;
+        setp(&buf_[0], &buf_[0] + buf_.size());
+        return failed_ ? -1 : 0;
+    }
+private:
+    int          fd_;
+    off_t        off_;
+    vector<char> buf_;
+    bool         failed_;
+    chrono::steady_clock::duration write_time_;
+};
+
+// Format the rows in [p, end) with the given column widths.
+static void format_chunk(const options& o, const vector<int>& widths,
+                  const char *p, const char *end, bool first, streambuf& sb,
+                  io::align_stats *stats)
+{
+    ostream os(&sb);
+    io::align table;
+    limit_widths(table, o);
+    table.widen(widths.begin(), widths.end());
+
+    io::align_proxy ap(table.attach(os, o.f, o.s, o.r));
+    setup_proxy(ap, o);
+    ap.setstats(stats);
+
+    formatter fmt(ap, o);
+    if (first)
+        fmt.start();
+    format_rows(fmt, p, end, os);
+}
+
+// Format chunks of the input on separate threads, and write each
+// at its final offset in the output file. Once the column widths are
+// known, the output of every chunk is independent of the others: the
+// parallel pass that computes the widths also measures the extent of
+// each chunk's output, which gives its size and thus its offset, and
+// a second one formats and writes it.
+static int format_parallel(const options& o, const mapped_file& in)
+{
+    int fd = open(o.oname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        cerr << "align: " << o.oname << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        cerr << "align: -P requires a regular output file" << endl;
+        close(fd);
+        return 1;
+    }
+
+    io::align table;
+    limit_widths(table, o);
+
+    unsigned n = thread_count(o);
+    vector<const char*> bounds = split_rows(in, n);
+
+    vector<io::raw_extent> extents(n);
+    parallel_for(n, [&](unsigned i) {
+            io::measure_extent(bounds[i], bounds[i + 1] - bounds[i], o.t, table,
+                               o.width, cap_mode(o), cap_marker(o), extents[i]);
+        });
+    for (unsigned i = 0; i < n; ++i)
+        table.widen(extents[i].widths.begin(), extents[i].widths.end());
+    widen_titles(table, o);
+    const vector<int>& widths = table.widths();
+
+    // The titles are printed before the first chunk.
+    count_buf cb;
+    format_chunk(o, widths, bounds[0], bounds[0], true, cb, NULL);
+
+    vector<off_t> offsets(n + 1, 0);
+    offsets[1] = cb.count();
+    for (unsigned i = 0; i < n; ++i)
+        offsets[i + 1] += offsets[i] + extents[i].size(table);
+
+    if (offsets[n] > 0 && posix_fallocate(fd, 0, offsets[n]) != 0 &&
+        ftruncate(fd, offsets[n]) != 0)
+    {
+        cerr << "align: " << o.oname << ": " << strerror(errno) << endl;
+        close(fd);
+        return 1;
+    }
+
+    vector<char> ok(n);
+    vector<run_stats> stats(n);
+    parallel_for(n, [&](unsigned i) {
+            pwrite_buf pb(fd, offsets[i]);
+            format_chunk(o, widths, bounds[i], bounds[i + 1], i == 0, pb, &stats[i].out);
+            pb.pubsync();
+            ok[i] = !pb.failed() && pb.offset() == offsets[i + 1];
+            stats[i].write_time = pb.write_time();
+        });
+    if (o.stats)
+        for (unsigned i = 0; i < n; ++i)
+        {
+            o.stats->out += stats[i].out;
+            o.stats->write_time += stats[i].write_time;
+        }
+
+    close(fd);
+    for (unsigned i = 0; i < n; ++i)
+        if (!ok[i])
+        {
+            cerr << "align: " << o.oname << ": write failed" << endl;
+            return 1;
+        }
+    return 0;
+}
+
+// Set when following should stop.
+static volatile sig_atomic_t stop_following = 0;
+
+extern "C" {
+static void on_stop_signal(int)
+{
+    stop_following = 1;
+}
+}
+
+// Format the input file to fd as it grows, until interrupted.
+static int follow_input(const options& o, int fd)
+{
+    follower in(o.iname);
+    if (!in.ok())
+    {
+        cerr << "align: " << o.iname << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    struct stat st;
+    if (stat(o.iname, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        cerr << "align: -F requires a regular input file" << endl;
+        return 1;
+    }
+
+    // Print the rows already read before exiting on a signal. The
+    // handlers interrupt waits, as they are set without SA_RESTART.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    writev_buf wb(fd);
+    ostream dout(&wb);
+    io::align table;
+    limit_widths(table, o);
+    io::align_proxy ap(table.attach(dout, o.f, o.s, o.r));
+    setup_proxy(ap, o, false);
+
+    formatter fmt(ap, o);
+    fmt.start();
+
+    typedef chrono::steady_clock clock;
+    vector<char> buf(1 << 16);
+    string carry; // start of a row continued in a later read
+    bool pending = false; // whether rows wait to be written
+    clock::time_point deadline;
+
+    while (!stop_following && dout.good())
+    {
+        ssize_t r = in.read(&buf[0], buf.size());
+        if (r < 0)
+        {
+            cerr << "align: " << o.iname << ": " << strerror(errno) << endl;
+            break;
+        }
+        if (r > 0)
+        {
+            if (!pending)
+            {
+                pending = true;
+                deadline = clock::now() + chrono::milliseconds(o.latency);
+            }
+
+            const char *p = &buf[0], *end = p + r;
+            for (const char *nl; (nl = (const char*)memchr(p, '\n', end - p)) != NULL; p = nl + 1)
+            {
+                if (carry.empty())
+                    fmt.line(p, nl - p);
+                else
+                {
+                    carry.append(p, nl - p);
+                    fmt.line(carry.data(), carry.size());
+                    carry.clear();
+                }
+            }
+            carry.append(p, end - p);
+        }
+
+        if (!pending)
+        {
+            in.wait(-1);
+            continue;
+        }
+
+        // Keep collecting the rows of a burst until the deadline.
+        int left = chrono::duration_cast<chrono::milliseconds>(deadline - clock::now()).count();
+        if (r > 0 && left > 0)
+            continue;
+        if (r == 0 && left > 0 && in.wait(left))
+            continue;
+        dout.flush();
+        pending = false;
+    }
+    dout.flush();
+    if (o.stats)
+        o.stats->write_time += wb.write_time();
+    return wb.failed() ? 1 : 0;
+}
+
+// Format the whole input to dout, collecting each row first if rowbuf.
+// Reading stops when *out_failed becomes true, if given. Returns false
+// if the input ends within a quoted CSV cell.
+static bool align_input(const options& o, const mapped_file& in, ostream& dout, bool rowbuf,
+                 const atomic<bool>* out_failed = NULL)
+{
+    // Set up aligned output.
+    io::align table;
+    if (o.exact)
+        prescan(table, o, in);
+    else
+        limit_widths(table, o);
+
+    io::align_proxy ap(table.attach(dout, o.f, o.s, o.r));
+    setup_proxy(ap, o, rowbuf);
+    ap.setlookahead(o.window_rows, o.window_bytes);
+
+    formatter fmt(ap, o);
+    fmt.start();
+
+    // Then go through the input, in place if possible.
+    if (in.ok())
+        format_rows(fmt, in.data(), in.data() + in.size(), dout);
+    else if (o.single)
+    {
+        ifstream din(o.iname);
+        string line;
+        while (din.good() && dout.good())
+        {
+            getline(din, line);
+            fmt.line(line.data(), line.size());
+        }
+    }
+    else
+    {
+        // Read and split the input on other threads.
+        int fd = open(o.iname, O_RDONLY);
+        if (fd == -1)
+        {
+            cerr << "align: " << o.iname << ": " << strerror(errno) << endl;
+            exit(1);
+        }
+
+        {
+            // If the output fails, the pipeline stops reading right away.
+            input_pipeline pin(fd);
+            for (row_batch *b; dout.good() && !(out_failed && *out_failed); pin.release(b))
+            {
+                if (!pin.ready())
+                    // Write out the rows so far before waiting for more
+                    // input, so that a failing output is noticed.
+                    dout.flush();
+                if ((b = pin.next(out_failed)) == NULL)
+                    break;
+
+                if (b->has_head)
+                    fmt.line(b->head.data(), b->head.size());
+                for (size_t i = 0; i < b->rows.size() && dout.good(); ++i)
+                    fmt.line(b->rows[i].first, b->rows[i].second);
+            }
+        }
+        close(fd);
+    }
+
+    if (fmt.finish() || !dout.good())
+        return true;
+    cerr << "align: " << o.iname << ": quoted cell not closed at end of input" << endl;
+    return false;
+}
+
 int main(int argc, char **argv)
 {
-    char f = ' '; // fill character
-    char s = ' '; // column separator
-    char r = '-'; // horizontal rule
-    char t = '\t'; // tab character for input
-    char R = '='; // input prefix for hline
-    char C = '#'; // input prefix for comments
-    char H = ';'; // input prefix for titles
-    bool paginate = false; // whether to repeat column headers at intervals
-    int max_lines_per_page = 25; // number of lines per interval
-    bool special = false; // whether to interpret special prefixes
-    char *headtext = NULL; // default column headers
-    bool underline_heads = false; // whether to produce a rule underneath titles
-    const char *iname = "/dev/stdin"; // input file
-    const char *oname = "/dev/stdout"; // output file
+    options o;
+    stats_report report;
 
     // Attempt to retrieve terminal size from /dev/tty
     {
@@ -96,110 +984,167 @@ int main(int argc, char **argv)
         if ( -1 != (fd = open("/dev/tty", O_RDONLY)) &&
              -1 != ioctl(fd, TIOCGWINSZ, &sz) &&
              sz.ws_row > 0)
-            max_lines_per_page = sz.ws_row;
+            o.max_lines_per_page = sz.ws_row;
 
         if (fd != -1) close(fd);
     }
 
     // Parse command-line argument and override defaults.
-    char ch;
-    while ((ch = getopt(argc, argv, "hipuVf:s:r:n:T:t:")) != -1)
+    enum { opt_stats = 256 };
+    static const struct option long_options[] = {
+        { "stats", no_argument, NULL, opt_stats },
+        { NULL, 0, NULL, 0 }
+    };
+    int ch;
+    bool tab_set = false;
+    while ((ch = getopt_long(argc, argv, "hipuVxPSUabcFf:s:r:n:T:t:j:w:W:M:m:L:B:",
+                             long_options, NULL)) != -1)
     {
         switch (ch) {
-        case 'f': f = optarg[0]; break;
-        case 's': s = optarg[0]; break;
-        case 'r': r = optarg[0]; break;
-        case 'p': paginate = true; break;
-        case 'n': max_lines_per_page = atoi(optarg); break;
-        case 'i': special = true; break;
-        case 'T': headtext = optarg; break;
-        case 'u': underline_heads = true; break;
-        case 't': t = optarg[0]; break;
+        case opt_stats: o.stats = report.enable(); break;
+        case 'f': o.f = optarg[0]; break;
+        case 's': o.s = optarg[0]; break;
+        case 'r': o.r = optarg[0]; break;
+        case 'p': o.paginate = true; break;
+        case 'n': o.max_lines_per_page = atoi(optarg); break;
+        case 'i': o.special = true; break;
+        case 'T': o.headtext = optarg; break;
+        case 'u': o.underline_heads = true; break;
+        case 't': o.t = optarg; tab_set = true; break;
+        case 'b': o.t = ""; tab_set = true; break;
+        case 'c': o.csv = true; break;
+        case 'F': o.follow = true; break;
+        case 'L': o.latency = atoi(optarg); break;
+        case 'B':
+            if (!parse_flush(optarg, o))
+            {
+                cerr << "align: invalid flush policy: " << optarg << endl;
+                return 1;
+            }
+            break;
         case 'h': usage(cout, argv[0]); break;
-        case 'H': H = optarg[0]; break;
-        case 'C': C = optarg[0]; break;
-        case 'R': R = optarg[0]; break;
+        case 'H': o.H = optarg[0]; break;
+        case 'C': o.C = optarg[0]; break;
+        case 'R': o.R = optarg[0]; break;
         case 'V': version(cout); break;
+        case 'x': o.exact = true; break;
+        case 'P': o.parallel = o.exact = true; break;
+        case 'j': o.jobs = atoi(optarg); break;
+        case 'S': o.single = true; break;
+        case 'w': o.window_rows = atoi(optarg); break;
+        case 'W': o.window_bytes = strtoul(optarg, NULL, 10); break;
+        case 'U': o.width |= io::width_utf8; break;
+        case 'a': o.width |= io::width_ansi; break;
+        case 'M':
+            if (!parse_max_width(optarg, o))
+            {
+                cerr << "align: invalid width limit: " << optarg << endl;
+                return 1;
+            }
+            break;
+        case 'm':
+            if (!strcmp(optarg, "overflow"))
+                o.cap = io::cap_overflow;
+            else if (!strcmp(optarg, "truncate"))
+                o.cap = io::cap_truncate;
+            else if (!strcmp(optarg, "elide"))
+                o.cap = io::cap_elide;
+            else
+            {
+                cerr << "align: invalid mode: " << optarg << endl;
+                return 1;
+            }
+            break;
         default: exit(1); break;
         }
     }
 
+    if (o.csv)
+    {
+        if (!tab_set)
+            o.t = ",";
+        if (strlen(o.t) != 1)
+        {
+            cerr << "align: -c requires a separator of one character" << endl;
+            return 1;
+        }
+    }
+
     argc -= optind;
     argv += optind;
 
     // Configure the input/output streams.
     if (argc > 0)
-        iname = argv[0];
+        o.iname = argv[0];
     if (argc > 1)
-        oname = argv[1];
-
-    ofstream dout(oname);
-    ifstream din(iname);
+        o.oname = argv[1];
 
-    // Set up aligned output.
-    io::align table;
-    io::align_proxy ap(table.attach(dout, f, s, r, t));
-
-    int line_num = 1;
-
-    // If titles are given from the command line, start with that.
-    if (headtext)
+    if (o.follow && (o.exact || o.window_rows || o.window_bytes))
     {
-        ap.rawheads(headtext);
-        ap << io::endr << io::heads;
+        cerr << "align: -F cannot be combined with -x, -P, -w or -W" << endl;
+        return 1;
+    }
 
-        line_num += 1;
+    mapped_file in(o.iname);
+    if (o.exact && !in.ok())
+    {
+        cerr << "align: -x requires a regular input file" << endl;
+        return 1;
+    }
 
-        if (underline_heads)
+    if (o.parallel)
+    {
+        if (o.paginate || o.special || o.csv || o.window_rows || o.window_bytes)
         {
-            ap << io::hline;
-            line_num += 1;
+            cerr << "align: -P cannot be combined with -p, -i, -c, -w or -W" << endl;
+            return 1;
         }
+        return format_parallel(o, in);
     }
 
-    // Then go through the input stream.
-    while (din.good() && dout.good())
+    int fd = open(o.oname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
     {
-        string line;
-        getline(din, line);
-
-        if (special && !line.empty() && line[0] == C)
-            continue;
+        cerr << "align: " << o.oname << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    o.out_fd = fd;
 
-        bool page_boundary = paginate && line_num + 1 >= max_lines_per_page;
-        bool head_prefix = special && !line.empty() && line[0] == H;
+    if (o.follow)
+    {
+        int r = follow_input(o, fd);
+        close(fd);
+        return r;
+    }
 
-        if (page_boundary || head_prefix)
+    if (o.single)
+    {
+        // Write on this thread with writev(). The rows are not
+        // collected, so that long cells of a mapped input are
+        // written from the mapping.
+        writev_buf wb(fd, in.data(), in.size());
+        bool ok;
         {
-            if (head_prefix)
-            {
-                line.push_back('\0');
-                ap << io::rawheads(line) << io::endr;
-            }
-
-            if (line_num > 1)
-                ap << ' ' << io::endr;
-
-            ap << io::heads;
-            line_num = 2;
-
-            if (underline_heads)
-            {
-                ap << io::hline;
-                line_num += 1;
-            }
-
-            if (head_prefix)
-                continue;
+            ostream dout(&wb);
+            ok = align_input(o, in, dout, false);
         }
+        ok = wb.pubsync() == 0 && ok;
+        if (o.stats)
+            o.stats->write_time += wb.write_time();
+        close(fd);
+        return ok ? 0 : 1;
+    }
 
-        if (special && !line.empty() && line[0] == R)
-            ap << io::hline;
-        else {
-            line.push_back('\0');
-            ap << io::raw(line) << io::endr;
-        }
-        line_num += 1;
+    // Write the output on another thread.
+    output_pipeline pout(fd);
+    bool ok;
+    {
+        ostream dout(pout.buf());
+        ok = align_input(o, in, dout, true, pout.failed());
     }
-    return 0;
+    ok = pout.finish() && ok;
+    if (o.stats)
+        o.stats->write_time += pout.write_time();
+    close(fd);
+    return ok ? 0 : 1;
 }
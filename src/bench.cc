@@ -1,75 +1,1039 @@
 #include "ioalign.h"
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <new>
 #include <unistd.h>
-#include <cstdlib>
-#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 using namespace std;
 
-volatile bool done = false;
-void handler(int n)
+// Allocation counting: every call to the global operator new is
+// counted, so that scenarios can report heap allocations per run.
+
+static atomic<unsigned long long> allocations(0);
+
+void *operator new(size_t n)
 {
-    done = true;
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw bad_alloc();
 }
 
-int main(int argc, char **argv)
+// Not inlined, so that GCC does not mistake the call to free() for
+// one on memory from the standard operator new.
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+
+// Output target: a buffered stream buffer that discards its contents,
+// counting characters and flushes.
+class null_sink : public streambuf
+{
+public:
+    null_sink() : bytes_(0), flushes_(0) { setp(buf_, buf_ + sizeof buf_); }
+
+    unsigned long long bytes() const { return bytes_ + (pptr() - pbase()); }
+    unsigned long long flushes() const { return flushes_; }
+
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        bytes_ += pptr() - pbase();
+        setp(buf_, buf_ + sizeof buf_);
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    virtual int sync()
+    {
+        ++flushes_;
+        bytes_ += pptr() - pbase();
+        setp(buf_, buf_ + sizeof buf_);
+        return 0;
+    }
+
+private:
+    unsigned long long bytes_;
+    unsigned long long flushes_;
+    char               buf_[65536];
+};
+
+// Deterministic pseudo-random numbers, so that runs are comparable.
+class lcg
+{
+public:
+    explicit lcg(unsigned long long seed = 42) : x_(seed) {}
+    unsigned next(unsigned n)
+    {
+        x_ = x_ * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned)(x_ >> 33) % n;
+    }
+    string word(unsigned minlen, unsigned maxlen)
+    {
+        string w(minlen + next(maxlen - minlen + 1), ' ');
+        for (size_t i = 0; i < w.size(); ++i)
+            w[i] = 'a' + next(26);
+        return w;
+    }
+private:
+    unsigned long long x_;
+};
+
+// Optional hardware counters, read with perf_event_open(2).
+class perf_counters
+{
+public:
+    perf_counters() : ok_(false) { fds_[0] = fds_[1] = fds_[2] = -1; }
+    ~perf_counters() { for (int i = 0; i < 3; ++i) if (fds_[i] != -1) close(fds_[i]); }
+
+    bool open()
+    {
+        static const unsigned long long configs[3] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+        };
+        for (int i = 0; i < 3; ++i)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1; // also count children, for the CLI scenario
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds_[i] == -1)
+                return false;
+        }
+        return ok_ = true;
+    }
+
+    void start()
+    {
+        for (int i = 0; ok_ && i < 3; ++i)
+        {
+            ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    void stop()
+    {
+        for (int i = 0; ok_ && i < 3; ++i)
+        {
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds_[i], &values_[i], sizeof values_[i]) != sizeof values_[i])
+                values_[i] = 0;
+        }
+    }
+
+    bool ok() const { return ok_; }
+    unsigned long long cycles() const { return values_[0]; }
+    unsigned long long instructions() const { return values_[1]; }
+    unsigned long long cache_misses() const { return values_[2]; }
+
+private:
+    perf_counters(const perf_counters&);
+    perf_counters& operator=(const perf_counters&);
+
+    bool               ok_;
+    int                fds_[3];
+    unsigned long long values_[3];
+};
+
+struct result
+{
+    string             name;
+    double             seconds;
+    unsigned long long rows;
+    unsigned long long cells;
+    unsigned long long bytes;
+    unsigned long long flushes;
+    long long          allocs; // -1 if not measured
+    bool               has_perf;
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long cache_misses;
+
+    result()
+        : name(), seconds(0), rows(0), cells(0), bytes(0), flushes(0), allocs(-1),
+          has_perf(false), cycles(0), instructions(0), cache_misses(0)
+    {}
+};
+
+// A formatting scenario: begin() attaches to the output stream, row()
+// formats one row and returns its number of cells, end() detaches.
+class scenario
 {
-    if (argc < 3)
+public:
+    virtual ~scenario() {}
+    virtual const char *name() const = 0;
+    virtual const char *description() const = 0;
+    virtual void begin(ostream& os) = 0;
+    virtual unsigned row() = 0;
+    virtual void end() = 0;
+};
+
+// Like scenario, for scenarios using a proxy.
+class align_scenario : public scenario
+{
+public:
+    align_scenario() : a_(NULL), ap_(NULL) {}
+    virtual void begin(ostream& os)
     {
-        cerr << "usage: " << argv[0] << " <seconds> [align | plain]" << endl;
-        return 1;
+        a_ = new io::align;
+        ap_ = new io::align_proxy(a_->attach(os));
+        setup(*ap_);
     }
+    virtual void end()
+    {
+        delete ap_;
+        delete a_;
+        ap_ = NULL;
+        a_ = NULL;
+    }
+    virtual unsigned row() { return row(*ap_); }
+protected:
+    virtual void setup(io::align_proxy&) {}
+    virtual unsigned row(io::align_proxy& ap) = 0;
+private:
+    align_scenario(const align_scenario&);
+    align_scenario& operator=(const align_scenario&);
 
-    int seconds = atoi(argv[1]);
-    signal(SIGALRM, &handler);
-    alarm(seconds);
+    io::align*       a_;
+    io::align_proxy* ap_;
+};
 
-    ostringstream os;
-    int i = 0;
+// Baseline: the mod-11 table without alignment.
+class plain_scenario : public scenario
+{
+public:
+    plain_scenario() : os_(NULL), i_(0) {}
+    const char *name() const { return "plain"; }
+    const char *description() const { return "10 integer columns, no alignment"; }
+    void begin(ostream& os) { os_ = &os; }
+    void end() {}
+    unsigned row()
+    {
+        i_ = i_ % 10 + 1;
+        for (int k = 1; k <= 10; ++k)
+            *os_ << (i_ * k % 11) << ' ';
+        *os_ << '\n';
+        return 10;
+    }
+private:
+    plain_scenario(const plain_scenario&);
+    plain_scenario& operator=(const plain_scenario&);
 
-    if (!strcmp(argv[2], "align"))
+    ostream* os_;
+    int      i_;
+};
+
+// The mod-11 table with io::next, as in mod11.cc.
+class narrow_scenario : public align_scenario
+{
+public:
+    narrow_scenario() : i_(0) {}
+    const char *name() const { return "narrow"; }
+    const char *description() const { return "10 integer columns with io::next"; }
+protected:
+    void setup(io::align_proxy& ap)
     {
-        io::align a;
-        io::align_proxy ap = a.attach(os);
         for (int j = 1; j <= 10; ++j)
             ap << io::head("", 2);
         ap << io::endr;
-        while (!done)
-            for (int j = 1; j <= 10; ++j)
+    }
+    unsigned row(io::align_proxy& ap)
+    {
+        i_ = i_ % 10 + 1;
+        for (int k = 1; k <= 10; ++k)
+            ap << (i_ * k % 11) << io::next;
+        return 10;
+    }
+private:
+    int i_;
+};
+
+// The same table, flushing the stream after every 64 rows.
+class flush_scenario : public narrow_scenario
+{
+public:
+    const char *name() const { return "flush"; }
+    const char *description() const { return "narrow, flushing every 64 rows"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        narrow_scenario::setup(ap);
+        ap.setflush(io::flush_rows, 64);
+    }
+};
+
+// The same table, counting the output.
+class stats_scenario : public narrow_scenario
+{
+public:
+    stats_scenario() : stats_() {}
+    const char *name() const { return "stats"; }
+    const char *description() const { return "narrow, with io::align_stats counters"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        narrow_scenario::setup(ap);
+        ap.setstats(&stats_);
+    }
+private:
+    io::align_stats stats_;
+};
+
+// The same table, one row() call per row.
+class row_scenario : public align_scenario
+{
+public:
+    row_scenario() : i_(0) {}
+    const char *name() const { return "row"; }
+    const char *description() const { return "narrow, with row()"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        for (int j = 1; j <= 10; ++j)
+            ap << io::head("", 2);
+        ap << io::endr;
+    }
+    unsigned row(io::align_proxy& ap)
+    {
+        i_ = i_ % 10 + 1;
+        ap.row(i_ % 11, i_ * 2 % 11, i_ * 3 % 11, i_ * 4 % 11, i_ * 5 % 11,
+               i_ * 6 % 11, i_ * 7 % 11, i_ * 8 % 11, i_ * 9 % 11, i_ * 10 % 11);
+        return 10;
+    }
+private:
+    int i_;
+};
+
+// The same table, with the columns fixed at compile time.
+class static_scenario : public scenario
+{
+public:
+    typedef io::basic_static_align<ostream, 10> table_type;
+
+    static_scenario() : a_(NULL), ap_(NULL), i_(0) {}
+    const char *name() const { return "static"; }
+    const char *description() const { return "narrow, with basic_static_align"; }
+    void begin(ostream& os)
+    {
+        static const int widths[10] = { 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 };
+        a_ = new table_type(widths);
+        ap_ = new table_type::proxy_type(a_->attach(os));
+    }
+    void end()
+    {
+        delete ap_;
+        delete a_;
+        ap_ = NULL;
+        a_ = NULL;
+    }
+    unsigned row()
+    {
+        i_ = i_ % 10 + 1;
+        for (int k = 1; k <= 10; ++k)
+            *ap_ << (i_ * k % 11) << io::next;
+        return 10;
+    }
+private:
+    static_scenario(const static_scenario&);
+    static_scenario& operator=(const static_scenario&);
+
+    table_type*             a_;
+    table_type::proxy_type* ap_;
+    int                     i_;
+};
+
+// Many short string columns.
+class wide_scenario : public align_scenario
+{
+public:
+    wide_scenario() : words_(), i_(0)
+    {
+        lcg g;
+        for (int k = 0; k < 1024; ++k)
+            words_.push_back(g.word(1, 8));
+    }
+    const char *name() const { return "wide"; }
+    const char *description() const { return "40 short string columns"; }
+protected:
+    unsigned row(io::align_proxy& ap)
+    {
+        for (int k = 0; k < 40; ++k)
+        {
+            ap << words_[i_++ % words_.size()];
+            if (k < 39)
+                ap << io::tab;
+        }
+        ap << io::endr;
+        return 40;
+    }
+private:
+    vector<string> words_;
+    size_t         i_;
+};
+
+// Few columns of long free text.
+class text_scenario : public align_scenario
+{
+public:
+    text_scenario() : texts_(), i_(0)
+    {
+        lcg g;
+        for (int k = 0; k < 256; ++k)
+            texts_.push_back(g.word(20, 200));
+    }
+    const char *name() const { return "text"; }
+    const char *description() const { return "4 columns of 20-200 characters"; }
+protected:
+    unsigned row(io::align_proxy& ap)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            ap << texts_[i_++ % texts_.size()];
+            if (k < 3)
+                ap << io::tab;
+        }
+        ap << io::endr;
+        return 4;
+    }
+private:
+    vector<string> texts_;
+    size_t         i_;
+};
+
+// Long text counted by display width: ASCII is skipped in blocks.
+class utf8_scenario : public text_scenario
+{
+public:
+    const char *name() const { return "utf8"; }
+    const char *description() const { return "text, counting the display width of UTF-8"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        ap.setwidth(io::width_utf8);
+    }
+};
+
+// Long text, looking out for escape sequences.
+class ansi_scenario : public text_scenario
+{
+public:
+    const char *name() const { return "ansi"; }
+    const char *description() const { return "text, not counting ANSI escape sequences"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        ap.setwidth(io::width_ansi);
+    }
+};
+
+// Integer and floating-point columns.
+class numeric_scenario : public align_scenario
+{
+public:
+    numeric_scenario() : g_() {}
+    const char *name() const { return "numeric"; }
+    const char *description() const { return "4 integer and 4 fixed-point columns"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        ap << fixed << setprecision(3);
+    }
+    unsigned row(io::align_proxy& ap)
+    {
+        for (int k = 0; k < 4; ++k)
+            ap << g_.next(1000000) << io::tab;
+        for (int k = 0; k < 4; ++k)
+        {
+            ap << g_.next(1000000) / 997.0;
+            if (k < 3)
+                ap << io::tab;
+        }
+        ap << io::endr;
+        return 8;
+    }
+private:
+    lcg g_;
+};
+
+// Tab-separated rows parsed with io::raw.
+class raw_scenario : public align_scenario
+{
+public:
+    raw_scenario() : lines_(), i_(0) { fill("\t"); }
+    const char *name() const { return "raw"; }
+    const char *description() const { return "8-column tab-separated rows via raw()"; }
+protected:
+    unsigned row(io::align_proxy& ap)
+    {
+        const string& l = lines_[i_++ % lines_.size()];
+        ap.raw(l.data(), l.size());
+        ap << io::endr;
+        return 8;
+    }
+
+    // Generate rows whose cells are separated by sep, or by runs of
+    // 1-4 spaces if sep is empty.
+    explicit raw_scenario(const char *sep) : lines_(), i_(0) { fill(sep); }
+    void fill(const char *sep)
+    {
+        lcg g;
+        for (int k = 0; k < 1024; ++k)
+        {
+            string l;
+            for (int c = 0; c < 8; ++c)
             {
-                for (int k = 1; k <= 10; ++k)
-                {
-                    ap << (j * k % 11) << io::next;
-                }
-                ++i;
+                if (c)
+                    l += *sep ? string(sep) : string(1 + g.next(4), ' ');
+                // Empty cells cannot be told apart from blanks.
+                l += g.word(*sep ? 0 : 1, 16);
             }
+            lines_.push_back(l);
+        }
     }
-    else if (!strcmp(argv[2], "plain"))
+private:
+    vector<string> lines_;
+    size_t         i_;
+};
+
+// Rows with a separator of several characters.
+class rawsep_scenario : public raw_scenario
+{
+public:
+    rawsep_scenario() : raw_scenario(" | ") {}
+    const char *name() const { return "rawsep"; }
+    const char *description() const { return "8-column rows separated by \" | \" via raw()"; }
+protected:
+    void setup(io::align_proxy& ap)
     {
-        for (int j = 1; j <= 10; ++j)
-            os << "  ";
-        os << endl;
-        ++i;
-        while (!done)
-            for (int j = 1; j <= 10; ++j)
+        ap.setrawsep(" | ");
+    }
+};
+
+// Rows padded with spaces, split on runs of blanks.
+class blanks_scenario : public raw_scenario
+{
+public:
+    blanks_scenario() : raw_scenario("") {}
+    const char *name() const { return "blanks"; }
+    const char *description() const { return "8-column rows split on runs of spaces via raw()"; }
+protected:
+    void setup(io::align_proxy& ap)
+    {
+        ap.setrawsep("");
+    }
+};
+
+// CSV rows where every other cell is quoted and holds a comma.
+class csv_scenario : public align_scenario
+{
+public:
+    csv_scenario() : lines_(), i_(0)
+    {
+        lcg g;
+        for (int k = 0; k < 1024; ++k)
+        {
+            string l;
+            for (int c = 0; c < 8; ++c)
             {
-                for (int k = 1; k <= 10; ++k)
-                    os << (j * k % 11) << ' ';
-                os << endl;
-                ++i;
+                if (c)
+                    l += ',';
+                if (c % 2)
+                    l += '"' + g.word(0, 8) + ", " + g.word(0, 6) + '"';
+                else
+                    l += g.word(0, 16);
             }
+            lines_.push_back(l + '\n');
+        }
     }
-    else
+    const char *name() const { return "csv"; }
+    const char *description() const { return "8-column CSV rows with quoted commas via raw_csv()"; }
+protected:
+    unsigned row(io::align_proxy& ap)
+    {
+        const string& l = lines_[i_++ % lines_.size()];
+        ap.raw_csv(l.data(), l.size());
+        return 8;
+    }
+private:
+    vector<string> lines_;
+    size_t         i_;
+};
+
+// Pagination: new titles and a rule every 20 rows.
+class paginate_scenario : public align_scenario
+{
+public:
+    paginate_scenario() : words_(), i_(0)
+    {
+        lcg g;
+        for (int k = 0; k < 1024; ++k)
+            words_.push_back(g.word(1, 12));
+    }
+    const char *name() const { return "paginate"; }
+    const char *description() const { return "6 columns, new titles and a rule every 20 rows"; }
+protected:
+    unsigned row(io::align_proxy& ap)
+    {
+        if (i_ % 20 == 0)
+            // Titles longer than the small string buffer.
+            ap << io::resetheads
+               << io::head("name of the entry") << io::head("kind of the entry")
+               << io::head("size in kilobytes") << io::head("owner of the entry")
+               << io::head("group of the owner") << io::head("path to the entry")
+               << io::endr << io::heads << io::hline;
+        for (int k = 0; k < 6; ++k)
+        {
+            ap << words_[(i_ * 6 + k) % words_.size()];
+            if (k < 5)
+                ap << io::tab;
+        }
+        ap << io::endr;
+        ++i_;
+        return 6;
+    }
+private:
+    vector<string> words_;
+    size_t         i_;
+};
+
+typedef chrono::steady_clock bench_clock;
+
+static double since(bench_clock::time_point t0)
+{
+    return chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+static result run_scenario(scenario& sc, double seconds, bool perf)
+{
+    null_sink sink;
+    ostream os(&sink);
+    perf_counters pc;
+    if (perf)
+        pc.open();
+
+    result r = result();
+    r.name = sc.name();
+
+    sc.begin(os);
+
+    // Warm up: let the column widths and buffers settle.
+    for (int i = 0; i < 1000; ++i)
+        sc.row();
+
+    unsigned long long bytes0 = sink.bytes(), flushes0 = sink.flushes();
+    unsigned long long allocs0 = allocations;
+    pc.start();
+    bench_clock::time_point t0 = bench_clock::now();
+
+    do
     {
-        cerr << "unrecognized argument: " << argv[2] << endl;
-        return 1;
+        for (int i = 0; i < 1024; ++i)
+            r.cells += sc.row();
+        r.rows += 1024;
     }
+    while (since(t0) < seconds);
+
+    r.seconds = since(t0);
+    pc.stop();
+    r.bytes = sink.bytes() - bytes0;
+    r.flushes = sink.flushes() - flushes0;
+    r.allocs = allocations - allocs0;
+    r.has_perf = pc.ok();
+    r.cycles = pc.cycles();
+    r.instructions = pc.instructions();
+    r.cache_misses = pc.cache_misses();
 
-    cout << i << " rows formatted (" << os.str().size() << " bytes) in " << seconds
-         << "s = " << fixed << setprecision(1) << (float)i/(float)seconds << " rows/s" << endl;
+    sc.end();
+    return r;
+}
+
+// End-to-end: run the align utility on a generated file.
+static bool run_cli(const string& align_path, double seconds, bool perf, result& r)
+{
+    if (access(align_path.c_str(), X_OK) != 0)
+        return false;
+
+    const char *tmpdir = getenv("TMPDIR");
+    string corpus = string(tmpdir ? tmpdir : "/tmp") + "/align-bench-XXXXXX";
+    int fd = mkstemp(&corpus[0]);
+    if (fd == -1)
+        return false;
+
+    // About 16 MB of tab-separated rows.
+    unsigned long long rows = 0, cells = 0, bytes = 0;
+    {
+        lcg g;
+        string data;
+        while (data.size() < (16 << 20))
+        {
+            unsigned n = 1 + g.next(10);
+            for (unsigned c = 0; c < n; ++c)
+                data += (c ? "\t" : "") + g.word(0, 20);
+            data += '\n';
+            ++rows;
+            cells += n;
+        }
+        bytes = data.size();
+        if (write(fd, data.data(), data.size()) != (ssize_t)data.size())
+        {
+            close(fd);
+            unlink(corpus.c_str());
+            return false;
+        }
+        close(fd);
+    }
+
+    perf_counters pc;
+    if (perf)
+        pc.open();
+
+    r = result();
+    r.name = "cli";
+    r.allocs = -1;
+    pc.start();
+    bench_clock::time_point t0 = bench_clock::now();
+    bool ok = true;
+    do
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, 1);
+            execl(align_path.c_str(), align_path.c_str(), corpus.c_str(), (char*)NULL);
+            _exit(127);
+        }
+        int status;
+        if (pid == -1 || waitpid(pid, &status, 0) != pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            ok = false;
+            break;
+        }
+        r.rows += rows;
+        r.cells += cells;
+        r.bytes += bytes;
+    }
+    while (since(t0) < seconds);
+    r.seconds = since(t0);
+    pc.stop();
+    r.has_perf = pc.ok();
+    r.cycles = pc.cycles();
+    r.instructions = pc.instructions();
+    r.cache_misses = pc.cache_misses();
+
+    unlink(corpus.c_str());
+    return ok;
+}
 
+// Several threads printing the mod-11 table to one stream, either
+// through an io::shared_align or through one proxy behind a mutex.
+static result run_parallel(bool shared, unsigned threads, double seconds, bool perf)
+{
+    null_sink sink;
+    ostream os(&sink);
+    perf_counters pc;
+    if (perf)
+        pc.open();
+
+    result r = result();
+    r.name = shared ? "shared" : "locked";
+    r.allocs = -1;
+
+    io::shared_align sa(os, 10);
+    io::align la;
+    io::align_proxy lp(la.attach(os));
+    mutex m;
+    for (unsigned j = 0; j < 10; ++j)
+    {
+        sa.widen(j, 2);
+        la.widen(j, 2);
+    }
+
+    atomic<bool> stop(false);
+    vector<unsigned long long> rows(threads);
+    vector<thread> ts;
+
+    pc.start();
+    bench_clock::time_point t0 = bench_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+        ts.push_back(thread([&, t] {
+            unsigned long long n = 0;
+            if (shared)
+            {
+                io::shared_align::writer w(sa);
+                for (int i = 1; !stop.load(memory_order_relaxed); i = i % 10 + 1, ++n)
+                    for (int k = 1; k <= 10; ++k)
+                        w << (i * k % 11) << io::next;
+            }
+            else
+                for (int i = 1; !stop.load(memory_order_relaxed); i = i % 10 + 1, ++n)
+                {
+                    lock_guard<mutex> g(m);
+                    for (int k = 1; k <= 10; ++k)
+                        lp << (i * k % 11) << io::next;
+                }
+            rows[t] = n;
+        }));
+
+    while (since(t0) < seconds)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    stop = true;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        ts[t].join();
+        r.rows += rows[t];
+    }
+    sa.flush();
+
+    r.seconds = since(t0);
+    pc.stop();
+    r.cells = r.rows * 10;
+    r.bytes = sink.bytes();
+    r.flushes = sink.flushes();
+    r.has_perf = pc.ok();
+    r.cycles = pc.cycles();
+    r.instructions = pc.instructions();
+    r.cache_misses = pc.cache_misses();
+    return r;
+}
+
+static void print_text(ostream& o, const vector<result>& rs)
+{
+    io::align a;
+    io::align_proxy ap(a.attach(o));
+    // Set the widths upfront, since alignment is incremental.
+    ap << io::head("scenario", 9) << io::head("rows", 10) << io::head("ns/cell", 8)
+       << io::head("MB/s", 8) << io::head("flushes", 8) << io::head("allocs", 8)
+       << io::head("cycles/cell", 11) << io::head("IPC", 5) << io::endr
+       << io::heads << io::hline;
+    for (size_t i = 0; i < rs.size(); ++i)
+    {
+        const result& r = rs[i];
+        ap << r.name << io::tab << r.rows << io::tab
+           << fixed << setprecision(2) << r.seconds * 1e9 / r.cells << io::tab
+           << setprecision(1) << r.bytes / r.seconds / 1e6 << io::tab
+           << r.flushes << io::tab;
+        if (r.allocs < 0)
+            ap << '-';
+        else
+            ap << r.allocs;
+        ap << io::tab;
+        if (r.has_perf)
+            ap << setprecision(1) << (double)r.cycles / r.cells << io::tab
+               << setprecision(2) << (double)r.instructions / r.cycles;
+        else
+            ap << '-' << io::tab << '-';
+        ap << io::endr;
+    }
+}
+
+static void print_json(ostream& o, const vector<result>& rs)
+{
+    o << "[\n";
+    for (size_t i = 0; i < rs.size(); ++i)
+    {
+        const result& r = rs[i];
+        o << "  {\"scenario\": \"" << r.name << "\""
+          << ", \"seconds\": " << r.seconds
+          << ", \"rows\": " << r.rows
+          << ", \"cells\": " << r.cells
+          << ", \"bytes\": " << r.bytes
+          << ", \"ns_per_cell\": " << r.seconds * 1e9 / r.cells
+          << ", \"mb_per_s\": " << r.bytes / r.seconds / 1e6
+          << ", \"flushes\": " << r.flushes
+          << ", \"allocations\": ";
+        if (r.allocs < 0)
+            o << "null";
+        else
+            o << r.allocs;
+        if (r.has_perf)
+            o << ", \"cycles\": " << r.cycles
+              << ", \"instructions\": " << r.instructions
+              << ", \"cache_misses\": " << r.cache_misses;
+        else
+            o << ", \"cycles\": null, \"instructions\": null, \"cache_misses\": null";
+        o << "}" << (i + 1 < rs.size() ? "," : "") << "\n";
+    }
+    o << "]" << endl;
+}
+
+// Time per cell of the named scenario, or 0 if it did not run.
+static double ns_per_cell(const vector<result>& rs, const string& name)
+{
+    for (size_t i = 0; i < rs.size(); ++i)
+        if (rs[i].name == name && rs[i].cells)
+            return rs[i].seconds * 1e9 / rs[i].cells;
     return 0;
 }
+
+static void usage(ostream& o, const char *pname, const vector<scenario*>& all)
+{
+    o << "Usage: " << pname << " [OPTION...] [SCENARIO...]\n"
+        "Measure the performance of io::align.\n"
+        "\n"
+        "Options:\n"
+        " -t S    Run each scenario for S seconds. (default: 1)\n"
+        " -j      Report results as JSON.\n"
+        " -p      Report hardware counters, if available.\n"
+        " -a PATH Use PATH for the cli scenario. (default: ./align)\n"
+        " -n N    Use N threads for the shared and locked scenarios. (default: 4)\n"
+        " -z      Fail if a scenario allocates memory after warm-up.\n"
+        " -w PCT  Fail if utf8 or ansi is more than PCT percent slower per cell\n"
+        "         than text.\n"
+        " -h      Display this help.\n"
+        "\n"
+        "Scenarios (default: all):\n";
+    for (size_t i = 0; i < all.size(); ++i)
+        o << " " << setw(9) << left << all[i]->name() << all[i]->description() << "\n";
+    o << " " << setw(9) << left << "shared" << "narrow, from several threads with io::shared_align\n"
+      << " " << setw(9) << left << "locked" << "narrow, from several threads sharing a proxy behind a mutex\n"
+      << " " << setw(9) << left << "cli" << "the align utility on 16 MB of generated rows\n";
+}
+
+int main(int argc, char **argv)
+{
+    plain_scenario plain;
+    narrow_scenario narrow;
+    flush_scenario flush_rows;
+    stats_scenario stats;
+    row_scenario row;
+    static_scenario static_table;
+    wide_scenario wide;
+    text_scenario text;
+    utf8_scenario utf8;
+    ansi_scenario ansi;
+    numeric_scenario numeric;
+    raw_scenario raw;
+    rawsep_scenario rawsep;
+    blanks_scenario blanks;
+    csv_scenario csv;
+    paginate_scenario paginate;
+
+    vector<scenario*> all;
+    all.push_back(&plain);
+    all.push_back(&narrow);
+    all.push_back(&flush_rows);
+    all.push_back(&stats);
+    all.push_back(&row);
+    all.push_back(&static_table);
+    all.push_back(&wide);
+    all.push_back(&text);
+    all.push_back(&utf8);
+    all.push_back(&ansi);
+    all.push_back(&numeric);
+    all.push_back(&raw);
+    all.push_back(&rawsep);
+    all.push_back(&blanks);
+    all.push_back(&csv);
+    all.push_back(&paginate);
+
+    double seconds = 1;
+    bool json = false, perf = false, zero_alloc = false;
+    double width_slack = -1;
+    string align_path = "./align";
+    unsigned threads = 4;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "hjpzt:a:n:w:")) != -1)
+    {
+        switch (ch) {
+        case 't': seconds = atof(optarg); break;
+        case 'j': json = true; break;
+        case 'p': perf = true; break;
+        case 'z': zero_alloc = true; break;
+        case 'w': width_slack = atof(optarg); break;
+        case 'a': align_path = optarg; break;
+        case 'n': threads = max(1, atoi(optarg)); break;
+        case 'h': usage(cout, argv[0], all); return 0;
+        default: return 1;
+        }
+    }
+
+    vector<string> names(argv + optind, argv + argc);
+    bool run_all = names.empty();
+    vector<result> results;
+
+    for (size_t i = 0; i < all.size(); ++i)
+        if (run_all || find(names.begin(), names.end(), all[i]->name()) != names.end())
+            results.push_back(run_scenario(*all[i], seconds, perf));
+
+    if (run_all || find(names.begin(), names.end(), "shared") != names.end())
+        results.push_back(run_parallel(true, threads, seconds, perf));
+    if (run_all || find(names.begin(), names.end(), "locked") != names.end())
+        results.push_back(run_parallel(false, threads, seconds, perf));
+
+    if (run_all || find(names.begin(), names.end(), "cli") != names.end())
+    {
+        result r;
+        if (run_cli(align_path, seconds, perf, r))
+            results.push_back(r);
+        else if (!run_all)
+        {
+            cerr << argv[0] << ": cannot run " << align_path << endl;
+            return 1;
+        }
+    }
+
+    if (json)
+        print_json(cout, results);
+    else
+        print_text(cout, results);
+
+    int status = 0;
+    for (size_t i = 0; zero_alloc && i < results.size(); ++i)
+        if (results[i].allocs > 0)
+        {
+            cerr << argv[0] << ": " << results[i].name << ": "
+                 << results[i].allocs << " allocations after warm-up" << endl;
+            status = 1;
+        }
+
+    // Counting display width should cost next to nothing on ASCII.
+    const char *counted[] = { "utf8", "ansi" };
+    double text_ns = ns_per_cell(results, "text");
+    for (size_t i = 0; width_slack >= 0 && i < sizeof counted / sizeof *counted; ++i)
+    {
+        double ns = ns_per_cell(results, counted[i]);
+        if (!text_ns || !ns)
+        {
+            cerr << argv[0] << ": -w needs the text and " << counted[i] << " scenarios" << endl;
+            status = 1;
+        }
+        else if (ns > text_ns * (1 + width_slack / 100))
+        {
+            cerr << argv[0] << ": " << counted[i] << ": " << ns << " ns/cell, "
+                 << (ns / text_ns - 1) * 100 << "% slower than text" << endl;
+            status = 1;
+        }
+    }
+    return status;
+}
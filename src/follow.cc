@@ -0,0 +1,97 @@
+// align -- column alignment for streams -*- C++ -*-
+//
+// Copyright (c) 2013 Raphael 'kena' Poss
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "follow.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Interval at which the file is checked without inotify.
+static const int poll_interval = 100;
+
+follower::follower(const char *name)
+    : fd_(open(name, O_RDONLY)), notify_(-1), off_(0)
+{
+#ifdef __linux__
+    if (fd_ != -1)
+    {
+        notify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notify_ != -1 && inotify_add_watch(notify_, name, IN_MODIFY | IN_ATTRIB) == -1)
+        {
+            close(notify_);
+            notify_ = -1;
+        }
+    }
+#endif
+}
+
+follower::~follower()
+{
+    if (notify_ != -1)
+        close(notify_);
+    if (fd_ != -1)
+        close(fd_);
+}
+
+ssize_t follower::read(char *buf, size_t n)
+{
+    ssize_t r;
+    do
+        r = pread(fd_, buf, n, off_);
+    while (r < 0 && errno == EINTR);
+
+    if (r == 0)
+    {
+        struct stat st;
+        if (fstat(fd_, &st) == 0 && st.st_size < off_)
+        {
+            off_ = 0;
+            return read(buf, n);
+        }
+    }
+    if (r > 0)
+        off_ += r;
+    return r;
+}
+
+bool follower::wait(int timeout)
+{
+    if (notify_ == -1)
+    {
+        // Without inotify, check again after a while.
+        int ms = (timeout >= 0 && timeout < poll_interval) ? timeout : poll_interval;
+        return poll(NULL, 0, ms) == 0 && ms == poll_interval;
+    }
+
+    struct pollfd p = { notify_, POLLIN, 0 };
+    if (poll(&p, 1, timeout) <= 0)
+        return false;
+
+    // Only the fact that something happened matters.
+    char events[4096];
+    while (::read(notify_, events, sizeof events) > 0)
+        ;
+    return true;
+}
@@ -0,0 +1,57 @@
+// align -- column alignment for streams -*- C++ -*-
+//
+// Copyright (c) 2013 Raphael 'kena' Poss
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef ALIGN_FOLLOW_H
+#define ALIGN_FOLLOW_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+// Reads a file as it grows, like tail -f. Changes are waited for
+// with inotify where available, and by polling the file otherwise.
+class follower
+{
+public:
+    explicit follower(const char *name);
+    ~follower();
+
+    // Whether the file could be opened.
+    bool ok() const { return fd_ != -1; }
+
+    // Read up to n characters added to the file since the last call.
+    // Returns 0 if there are none yet, or -1 on error. If the file was
+    // truncated, reading starts again from its beginning.
+    ssize_t read(char *buf, size_t n);
+
+    // Wait until the file may have changed, for at most timeout
+    // milliseconds if timeout >= 0. Returns false on timeout or if
+    // interrupted by a signal.
+    bool wait(int timeout);
+
+private:
+    follower(const follower&);
+    follower& operator=(const follower&);
+
+    int   fd_;
+    int   notify_; // inotify descriptor, or -1 to poll
+    off_t off_;    // offset of the next character to read
+};
+
+#endif
@@ -0,0 +1,295 @@
+// align -- column alignment for streams -*- C++ -*-
+//
+// Copyright (c) 2013 Raphael 'kena' Poss
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "pipeline.h"
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+
+using namespace std;
+
+void backoff::wait()
+{
+    if (n_ < 64)
+        ; // spin
+    else if (n_ < 128)
+        this_thread::yield();
+    else
+    {
+        // Sleep 10us, doubling up to 1ms, so that idle stages do
+        // not keep a core busy.
+        unsigned shift = n_ - 128 < 7 ? n_ - 128 : 7;
+        this_thread::sleep_for(chrono::microseconds(10 << shift));
+    }
+    ++n_;
+}
+
+input_pipeline::input_pipeline(int fd, size_t block_size, unsigned nblocks)
+    : fd_(fd), wake_(), done_(false), stop_(false),
+      blocks_(nblocks), batches_(nblocks + 2),
+      free_blocks_(nblocks), full_blocks_(nblocks),
+      free_batches_(nblocks + 2), full_batches_(nblocks + 2),
+      reader_(), splitter_()
+{
+    for (size_t i = 0; i < blocks_.size(); ++i)
+    {
+        blocks_[i].data.resize(block_size);
+        free_blocks_.push(&blocks_[i]);
+    }
+    for (size_t i = 0; i < batches_.size(); ++i)
+        free_batches_.push(&batches_[i]);
+    if (pipe(wake_) != 0)
+        wake_[0] = wake_[1] = -1;
+
+    reader_ = thread(&input_pipeline::read_loop, this);
+    splitter_ = thread(&input_pipeline::split_loop, this);
+}
+
+input_pipeline::~input_pipeline()
+{
+    stop_ = true;
+    if (wake_[1] != -1)
+    {
+        // Wake up the reader if it waits for input that may never come.
+        char c = 0;
+        while (write(wake_[1], &c, 1) < 0 && errno == EINTR)
+            ;
+    }
+    reader_.join();
+    splitter_.join();
+    if (wake_[0] != -1)
+    {
+        close(wake_[0]);
+        close(wake_[1]);
+    }
+}
+
+row_batch *input_pipeline::next(const atomic<bool>* stop)
+{
+    row_batch *b;
+    if (done_ || !full_batches_.pop(b, stop))
+        return NULL;
+    done_ = b->last;
+    return b;
+}
+
+void input_pipeline::release(row_batch *b)
+{
+    if (b->source)
+        free_blocks_.push(b->source);
+    free_batches_.push(b);
+}
+
+void input_pipeline::read_loop()
+{
+    for (;;)
+    {
+        block *b;
+        if (!free_blocks_.pop(b, &stop_))
+            return;
+
+        // Wait for input or for the pipeline to stop.
+        if (wake_[0] != -1)
+        {
+            struct pollfd p[2] = { { fd_, POLLIN, 0 }, { wake_[0], POLLIN, 0 } };
+            int n;
+            do
+                n = poll(p, 2, -1);
+            while (n < 0 && errno == EINTR);
+            if (p[1].revents)
+                return;
+        }
+
+        // Pass on whatever one read returns, so that rows arriving
+        // slowly on a pipe are not held back.
+        ssize_t r;
+        do
+            r = read(fd_, &b->data[0], b->data.size());
+        while (r < 0 && errno == EINTR);
+
+        if (r <= 0)
+        {
+            // End of input.
+            full_blocks_.push(NULL, &stop_);
+            return;
+        }
+        b->len = r;
+        if (!full_blocks_.push(b, &stop_))
+            return;
+    }
+}
+
+void input_pipeline::split_loop()
+{
+    string carry; // start of a row continued in the next block
+
+    for (;;)
+    {
+        block *b;
+        row_batch *rb;
+        if (!full_blocks_.pop(b, &stop_) || !free_batches_.pop(rb, &stop_))
+            return;
+
+        rb->source = b;
+        rb->has_head = false;
+        rb->rows.clear();
+        rb->last = (b == NULL);
+
+        if (!b)
+        {
+            // Like getline(), the text after the last newline is a
+            // row of its own, even if empty.
+            rb->head.swap(carry);
+            rb->has_head = true;
+            full_batches_.push(rb, &stop_);
+            return;
+        }
+
+        const char *p = &b->data[0], *end = p + b->len;
+        const char *nl = (const char*)memchr(p, '\n', end - p);
+        if (nl && !carry.empty())
+        {
+            carry.append(p, nl - p);
+            rb->head.swap(carry);
+            rb->has_head = true;
+            carry.clear();
+            p = nl + 1;
+            nl = (const char*)memchr(p, '\n', end - p);
+        }
+        for (; nl; nl = (const char*)memchr(p, '\n', end - p))
+        {
+            rb->rows.push_back(make_pair(p, (size_t)(nl - p)));
+            p = nl + 1;
+        }
+        carry.append(p, end - p);
+
+        if (!full_batches_.push(rb, &stop_))
+            return;
+    }
+}
+
+output_pipeline::output_pipeline(int fd, size_t block_size, unsigned nblocks)
+    : fd_(fd), finished_(false), failed_(false), write_time_(0),
+      blocks_(nblocks),
+      free_blocks_(nblocks), full_blocks_(nblocks + 1),
+      sink_(*this), writer_()
+{
+    for (size_t i = 0; i < blocks_.size(); ++i)
+    {
+        blocks_[i].data.resize(block_size);
+        free_blocks_.push(&blocks_[i]);
+    }
+    writer_ = thread(&output_pipeline::write_loop, this);
+}
+
+output_pipeline::~output_pipeline()
+{
+    finish();
+}
+
+bool output_pipeline::finish()
+{
+    if (!finished_)
+    {
+        finished_ = true;
+        sink_.hand_off();
+        full_blocks_.push(NULL);
+        writer_.join();
+    }
+    return !failed_;
+}
+
+void output_pipeline::write_loop()
+{
+    block *b;
+    while (full_blocks_.pop(b) && b)
+    {
+        // After a failure, keep recycling blocks so that the
+        // formatter is not blocked.
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t off = 0; !failed_ && off < b->len; )
+        {
+            ssize_t r = write(fd_, &b->data[off], b->len - off);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                failed_ = true;
+            else
+                off += r;
+        }
+        write_time_ += chrono::steady_clock::now() - start;
+        free_blocks_.push(b);
+    }
+}
+
+void output_pipeline::sink::hand_off()
+{
+    if (!cur_ || pptr() == pbase())
+        return;
+    cur_->len = pptr() - pbase();
+    p_.full_blocks_.push(cur_);
+    cur_ = NULL;
+    setp(NULL, NULL);
+}
+
+bool output_pipeline::sink::next_block()
+{
+    hand_off();
+    if (p_.failed_)
+        return false;
+    p_.free_blocks_.pop(cur_);
+    char *d = &cur_->data[0];
+    setp(d, d + cur_->data.size());
+    return true;
+}
+
+output_pipeline::sink::int_type output_pipeline::sink::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    if (!next_block())
+        return traits_type::eof();
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+streamsize output_pipeline::sink::xsputn(const char *s, streamsize n)
+{
+    streamsize done = 0;
+    while (done < n)
+    {
+        if (pptr() == epptr() && !next_block())
+            break;
+        streamsize k = min<streamsize>(n - done, epptr() - pptr());
+        memcpy(pptr(), s + done, k);
+        pbump(k);
+        done += k;
+    }
+    return done;
+}
+
+int output_pipeline::sink::sync()
+{
+    hand_off();
+    return p_.failed_ ? -1 : 0;
+}
@@ -0,0 +1,257 @@
+// align -- column alignment for streams -*- C++ -*-
+//
+// Copyright (c) 2013 Raphael 'kena' Poss
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef ALIGN_PIPELINE_H
+#define ALIGN_PIPELINE_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <utility>
+#include <streambuf>
+#include <cstddef>
+
+// Waits with increasing delays: spin first, then yield, then sleep.
+class backoff
+{
+public:
+    backoff() : n_(0) {}
+    void wait();
+private:
+    unsigned n_;
+};
+
+// Bounded lock-free queue between one producer thread and one
+// consumer thread.
+template<typename T>
+class spsc_queue
+{
+public:
+    // The capacity is rounded up to a power of two.
+    explicit spsc_queue(size_t capacity);
+
+    bool try_push(const T& v);
+    bool try_pop(T& v);
+
+    // Whether there is nothing to pop, as seen by the consumer.
+    bool empty() const
+    {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+    // Wait until v can be pushed, or give up if *stop becomes true.
+    bool push(const T& v, const std::atomic<bool>* stop = NULL);
+
+    // Wait until a value can be popped, or give up if *stop becomes true.
+    bool pop(T& v, const std::atomic<bool>* stop = NULL);
+
+private:
+    spsc_queue(const spsc_queue&);
+    spsc_queue& operator=(const spsc_queue&);
+
+    std::vector<T> slots_;
+    size_t         mask_;
+    alignas(64) std::atomic<size_t> head_; // next slot to pop
+    alignas(64) std::atomic<size_t> tail_; // next slot to push
+};
+
+// A block of bytes passed between pipeline stages.
+struct block
+{
+    std::vector<char> data;
+    size_t            len;
+
+    block() : data(), len(0) {}
+};
+
+// Complete input rows, in order: the head row if any, then the rows.
+struct row_batch
+{
+    block*      source;   // block the rows point into, or NULL
+    bool        has_head; // whether head holds a row
+    std::string head;     // row that started in earlier blocks
+    std::vector<std::pair<const char*, size_t> > rows;
+    bool        last;     // whether this is the last batch
+
+    row_batch() : source(NULL), has_head(false), head(), rows(), last(false) {}
+
+private:
+    row_batch(const row_batch&);
+    row_batch& operator=(const row_batch&);
+};
+
+// Reads an input file on one thread and splits it into rows on
+// another. The rows are consumed with next() and release() on a third.
+// Destroying the pipeline stops the reader even if it waits for input.
+class input_pipeline
+{
+public:
+    explicit input_pipeline(int fd, size_t block_size = 1 << 20, unsigned nblocks = 8);
+    ~input_pipeline();
+
+    // The next batch of rows, or NULL after the last one or once
+    // *stop becomes true.
+    row_batch *next(const std::atomic<bool>* stop = NULL);
+
+    // Whether next() can return without waiting for input.
+    bool ready() const { return done_ || !full_batches_.empty(); }
+
+    // Give a batch back once its rows are no longer used.
+    void release(row_batch *b);
+
+private:
+    input_pipeline(const input_pipeline&);
+    input_pipeline& operator=(const input_pipeline&);
+
+    void read_loop();
+    void split_loop();
+
+    int                     fd_;
+    int                     wake_[2]; // pipe that interrupts the reader
+    bool                    done_;
+    std::atomic<bool>       stop_;
+    std::vector<block>      blocks_;
+    std::vector<row_batch>  batches_;
+    spsc_queue<block*>      free_blocks_;
+    spsc_queue<block*>      full_blocks_;
+    spsc_queue<row_batch*>  free_batches_;
+    spsc_queue<row_batch*>  full_batches_;
+    std::thread             reader_;
+    std::thread             splitter_;
+};
+
+// Writes to an output file on a separate thread. Characters written
+// to buf() are collected in large blocks, which are handed to the
+// writer thread as they fill up or when the buffer is flushed.
+class output_pipeline
+{
+public:
+    explicit output_pipeline(int fd, size_t block_size = 1 << 20, unsigned nblocks = 4);
+    ~output_pipeline();
+
+    std::streambuf *buf() { return &sink_; }
+
+    // Write out everything and stop the writer thread. Returns false
+    // if a write failed.
+    bool finish();
+
+    // Becomes true once a write fails.
+    const std::atomic<bool>* failed() const { return &failed_; }
+
+    // Time the writer thread spent in write(), once finished.
+    std::chrono::steady_clock::duration write_time() const { return write_time_; }
+
+private:
+    output_pipeline(const output_pipeline&);
+    output_pipeline& operator=(const output_pipeline&);
+
+    class sink : public std::streambuf
+    {
+    public:
+        explicit sink(output_pipeline& p) : p_(p), cur_(NULL) {}
+        void hand_off();
+    protected:
+        virtual int_type overflow(int_type c);
+        virtual std::streamsize xsputn(const char *s, std::streamsize n);
+        virtual int sync();
+    private:
+        sink(const sink&);
+        sink& operator=(const sink&);
+        bool next_block();
+
+        output_pipeline& p_;
+        block*           cur_;
+    };
+
+    void write_loop();
+
+    int                 fd_;
+    bool                finished_;
+    std::atomic<bool>   failed_;
+    std::chrono::steady_clock::duration write_time_;
+    std::vector<block>  blocks_;
+    spsc_queue<block*>  free_blocks_;
+    spsc_queue<block*>  full_blocks_;
+    sink                sink_;
+    std::thread         writer_;
+};
+
+template<typename T>
+spsc_queue<T>::spsc_queue(size_t capacity)
+    : slots_(), mask_(0), head_(0), tail_(0)
+{
+    size_t n = 1;
+    while (n < capacity)
+        n <<= 1;
+    slots_.resize(n);
+    mask_ = n - 1;
+}
+
+template<typename T>
+bool spsc_queue<T>::try_push(const T& v)
+{
+    size_t t = tail_.load(std::memory_order_relaxed);
+    if (t - head_.load(std::memory_order_acquire) == slots_.size())
+        return false;
+    slots_[t & mask_] = v;
+    tail_.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool spsc_queue<T>::try_pop(T& v)
+{
+    size_t h = head_.load(std::memory_order_relaxed);
+    if (h == tail_.load(std::memory_order_acquire))
+        return false;
+    v = slots_[h & mask_];
+    head_.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool spsc_queue<T>::push(const T& v, const std::atomic<bool>* stop)
+{
+    backoff b;
+    while (!try_push(v))
+    {
+        if (stop && stop->load(std::memory_order_relaxed))
+            return false;
+        b.wait();
+    }
+    return true;
+}
+
+template<typename T>
+bool spsc_queue<T>::pop(T& v, const std::atomic<bool>* stop)
+{
+    backoff b;
+    while (!try_pop(v))
+    {
+        if (stop && stop->load(std::memory_order_relaxed))
+            return false;
+        b.wait();
+    }
+    return true;
+}
+
+#endif
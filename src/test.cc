@@ -1,9 +1,67 @@
 #include "ioalign.h"
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
+// Stream buffer that discards its output and counts flushes.
+class sync_counter : public streambuf
+{
+public:
+    sync_counter() : syncs(0) {}
+    int syncs;
+protected:
+    virtual int_type overflow(int_type c) { return traits_type::not_eof(c); }
+    virtual int sync() { ++syncs; return 0; }
+};
+
+// Print rows from several threads through one io::shared_align, then
+// check that each row came out whole and that the rows of each thread
+// kept their order.
+static bool check_shared(bool ordered)
+{
+    const int nthreads = 4, nrows = 2000;
+    string text;
+    {
+        io::string_sink ss(text);
+        ostream os(&ss);
+        io::shared_align sa(os, 3, ordered, 16);
+        vector<thread> threads;
+        for (int t = 0; t < nthreads; ++t)
+            threads.push_back(thread([&sa, t]() {
+                const string name = "thread" + to_string(t);
+                io::shared_align::writer w(sa);
+                for (int i = 0; i < nrows; ++i)
+                    if (i % 2)
+                        w.row(name, string(i % 7 + 1, 'x'), i);
+                    else
+                        w << name << io::tab << string(i % 7 + 1, 'x') << io::tab << i << io::endr;
+            }));
+        for (size_t t = 0; t < threads.size(); ++t)
+            threads[t].join();
+    }
+
+    istringstream in(text);
+    string line;
+    vector<int> next(nthreads, 0);
+    int rows = 0;
+    while (getline(in, line))
+    {
+        istringstream ls(line);
+        string name, xs, rest;
+        int t, i;
+        if (!(ls >> name >> xs >> i) || (ls >> rest) || name.size() != 7 ||
+            name.compare(0, 6, "thread") || (t = name[6] - '0') < 0 || t >= nthreads ||
+            i != next[t]++ || xs != string(i % 7 + 1, 'x'))
+            return false;
+        ++rows;
+    }
+    return rows == nthreads * nrows;
+}
+
 int main()
 {
     ofstream dout("/dev/stdout");
@@ -42,6 +100,167 @@ int main()
       << io::raw("hello\tagain\tthird") << io::endr
       << io::hline
       << 123 << io::tab << hex << 456 << io::endr;
+
+    s << -1 << io::tab << uppercase << 3054L << io::tab << oct << 8ULL << io::endr
+      << dec << nouppercase << -42 << io::tab << 1.0 / 3 << io::tab << 2.5e-10f << io::endr
+      << fixed << setprecision(2) << 3.14159 << io::tab << -0.005 << io::tab
+      << scientific << uppercase << 12345.678 << io::endr
+      << defaultfloat << setprecision(6) << showpos << 7 << io::tab << setw(5) << 8 << io::endr;
+
+    s << noshowpos << io::reset;
+    s.setwidth(io::width_utf8);
+    s << "naïve" << io::tab << "café" << io::tab << 1 << io::endr
+      << "日本語" << io::tab << "e\xcc\x81t\xc3\xa9" << io::tab << 2 << io::endr
+      << io::head("名前") << io::head("ok") << io::endr
+      << io::heads;
+
+    s.setwidth(io::width_utf8 | io::width_ansi);
+    s << "\x1b[31mred\x1b[0m" << io::tab << "\x1b]8;;http://x/\x1b\\link\x1b]8;;\x1b\\" << io::endr
+      << "plain" << io::tab << "text" << io::endr;
     s << flush;
-    return 0;
+
+    // A table with three columns and initial widths.
+    static const int w[3] = { 4, 2, 6 };
+    typedef io::basic_static_align<ostream, 3> fixed_table;
+    fixed_table ft(w);
+    fixed_table::proxy_type fs(ft.attach(dout));
+    fs << io::head("id") << io::head("n") << io::head("value") << io::endr
+       << io::heads << io::hline;
+    for (int i = 1; i <= 4; ++i)
+        fs << i << io::next << i * 7 << io::next << "v" << i * 111 << io::next;
+    fs << "a" << io::tab << "b" << io::tab << "c" << io::tab << "beyond" << io::endr
+       << io::hline;
+
+    // Whole rows at once.
+    io::align rt;
+    io::align_proxy rs(rt.attach(dout));
+    rs.heads_row("name", string("count"), "ratio");
+    rs.row("apples", 3, 0.25).row("pears", 12, 1.5).row("figs");
+
+    // Width limits.
+    io::align ct;
+    ct.setmaxwidth(6);
+    ct.setmaxwidth(1, 3);
+    io::align_proxy cs(ct.attach(dout));
+    cs.setoverflow(io::cap_elide, "~");
+    cs.heads_row("key", "value", "description");
+    cs.row("short", "abcdef", "long enough to be cut");
+    cs.setoverflow(io::cap_truncate);
+    cs.row("a", "abcdef", "long enough to be cut");
+    cs.setoverflow(io::cap_overflow);
+    cs.row("b", "abcdef", "long enough to overflow") << io::hline;
+
+    // Raw input split on a string and on runs of blanks.
+    io::align pt;
+    io::align_proxy ps(pt.attach(dout));
+    ps.setrawsep(" | ");
+    ps << io::raw("name | size | note\nalign | 42 | a|b\nx || y | z\n");
+    ps.setrawsep("");
+    ps << io::raw("  PID TTY      TIME CMD\n 4242 pts/0\t00:00:01   bash  \n\n   1 ?        00:00:09 init");
+    ps << io::endr << flush;
+
+    // CSV with quoted separators, doubled quotes and quoted newlines,
+    // some of them CR LF split across calls.
+    io::align vt;
+    io::align_proxy vs(vt.attach(dout));
+    vs.raw_csv("item,price,comment\r\n\"nuts, bolts\",3,\"so-called \"\"best\"\"\"\n");
+    vs.raw_csv("glue,\"12\",\"two\nlines\"\n\"split");
+    bool open = vs.inquotes();
+    vs.raw_csv(" cell\",end\n");
+    vs.raw_csv("\"cr\r\nlf\",\"cr\r");
+    vs.raw_csv("\nlf\",split\r");
+    vs.raw_csv("\n");
+    vs << flush;
+    dout << open << vs.inquotes() << endl;
+
+    // Flushes made by each policy over 8 rows of 3 cells.
+    static const io::flush_policy policies[5] = {
+        io::flush_never, io::flush_cell, io::flush_row, io::flush_rows, io::flush_bytes
+    };
+    for (int i = 0; i < 5; ++i)
+    {
+        sync_counter sc;
+        ostream fos(&sc);
+        io::align fa;
+        io::align_proxy fp(fa.attach(fos));
+        fp.setflush(policies[i], policies[i] == io::flush_bytes ? 40 : 3);
+        for (int j = 0; j < 8; ++j)
+            fp.row("abc", j, "defgh");
+        dout << sc.syncs << (i < 4 ? ' ' : '\n');
+    }
+    dout << flush;
+
+    // A row held back by io::flush_delay is flushed by polling once due.
+    {
+        sync_counter sc;
+        ostream fos(&sc);
+        io::align fa;
+        io::align_proxy fp(fa.attach(fos));
+        fp.setflush(io::flush_delay, 20);
+        long idle = fp.pollflush();
+        fp.row("abc", 1);
+        long due = fp.pollflush();
+        int early = sc.syncs;
+        this_thread::sleep_for(chrono::milliseconds(30));
+        long after = fp.pollflush();
+        dout << idle << ' ' << (due > 0 && due <= 20) << ' ' << early << ' '
+             << after << ' ' << sc.syncs << endl;
+    }
+
+    // Counts of what a proxy printed.
+    io::align_stats counts;
+    {
+        io::align nt;
+        io::align_proxy ns(nt.attach(dout));
+        ns.setstats(&counts);
+        ns.heads_row("k", "v");
+        ns << io::hline;
+        ns.row("a", 1).row("bbb", 22).row("cc", 333) << io::heads;
+    }
+    dout << counts.rows << ' ' << counts.cells << ' ' << counts.payload << ' '
+         << counts.padding << ' ' << counts.rule_chars << ' ' << counts.separators << ' ' << counts.heads << ' '
+         << counts.rules << ' ' << counts.widened[0] << ' ' << counts.widened[1] << endl;
+
+    // Tables rendered into a string and into a fixed buffer.
+    string text;
+    char buf[32];
+    {
+        io::string_sink ss(text);
+        io::array_sink as(buf, sizeof buf);
+        ostream tos(&ss), bos(&as);
+        io::align ta, ba;
+        io::align_proxy tp(ta.attach(tos)), bp(ba.attach(bos));
+        tp.row("in", "a", "string").row("size", ss.size());
+        bp.row("in", "a", "buffer").row("longer", "than", "the", "buffer");
+        bp << flush;
+        dout << text << as.size() << (as.overflowed() ? " overflowed" : "") << endl;
+        dout.write(as.data(), as.size()) << endl;
+    }
+
+    // Proxies on the same stream destroyed in the order of creation.
+    {
+        io::align ta, tb;
+        io::align_proxy *pa = new io::align_proxy(ta.attach(dout));
+        pa->row("first", "proxy");
+        io::align_proxy *pb = new io::align_proxy(tb.attach(dout));
+        delete pa;
+        pb->row("second", "proxy").row("still", "printed");
+        delete pb;
+        dout << "x" << endl;
+    }
+
+    // Raw titles measured by their display width.
+    {
+        io::align ut;
+        io::align_proxy up(ut.attach(dout));
+        up.setwidth(io::width_utf8);
+        up << io::rawheads("\xc3\xa9\xc3\xa9\tx") << io::endr << io::heads;
+        up << io::raw("a\tb\nccc\td\n") << flush;
+    }
+
+    // Rows published one at a time and in batches.
+    bool ordered = check_shared(true), unordered = check_shared(false);
+    dout << "shared_align ordered " << (ordered ? "ok" : "mixed up") << endl;
+    dout << "shared_align unordered " << (unordered ? "ok" : "mixed up") << endl;
+    return ordered && unordered ? 0 : 1;
 }
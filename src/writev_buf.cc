@@ -0,0 +1,135 @@
+// align -- column alignment for streams -*- C++ -*-
+//
+// Copyright (c) 2013 Raphael 'kena' Poss
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "writev_buf.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+
+using namespace std;
+
+writev_buf::writev_buf(int fd, const char *region, size_t region_len, size_t arena_size)
+    : fd_(fd), lo_(region), hi_(region + region_len),
+      arena_(arena_size), span_(&arena_[0]), iov_(), ref_bytes_(0), failed_(false),
+      write_time_(0)
+{
+    iov_.reserve(max_iov);
+    setp(&arena_[0], &arena_[0] + arena_.size());
+}
+
+writev_buf::~writev_buf()
+{
+    write_out();
+}
+
+void writev_buf::add(const char *s, size_t n)
+{
+    struct iovec v;
+    v.iov_base = (void*)s;
+    v.iov_len = n;
+    iov_.push_back(v);
+}
+
+void writev_buf::close_span()
+{
+    if (pptr() > span_)
+    {
+        add(span_, pptr() - span_);
+        span_ = pptr();
+    }
+}
+
+bool writev_buf::write_out()
+{
+    close_span();
+
+    // Write all the spans, resuming after partial writes.
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    struct iovec *v = iov_.empty() ? NULL : &iov_[0], *end = v + iov_.size();
+    while (!failed_ && v != end)
+    {
+        ssize_t r = writev(fd_, v, min<ptrdiff_t>(end - v, max_iov));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            failed_ = true;
+            break;
+        }
+        for (; v != end && (size_t)r >= v->iov_len; ++v)
+            r -= v->iov_len;
+        if (r > 0)
+        {
+            v->iov_base = (char*)v->iov_base + r;
+            v->iov_len -= r;
+        }
+    }
+
+    write_time_ += chrono::steady_clock::now() - start;
+
+    iov_.clear();
+    ref_bytes_ = 0;
+    span_ = &arena_[0];
+    setp(&arena_[0], &arena_[0] + arena_.size());
+    return !failed_;
+}
+
+writev_buf::int_type writev_buf::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    if (!write_out())
+        return traits_type::eof();
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+streamsize writev_buf::xsputn(const char *s, streamsize n)
+{
+    if (n >= min_ref && s >= lo_ && s + n <= hi_)
+    {
+        // Leave the span where it is.
+        close_span();
+        add(s, n);
+        ref_bytes_ += n;
+        if ((iov_.size() >= max_iov - 1 || ref_bytes_ >= arena_.size()) && !write_out())
+            return 0;
+        return n;
+    }
+
+    streamsize done = 0;
+    while (done < n)
+    {
+        if (pptr() == epptr() && !write_out())
+            break;
+        streamsize k = min<streamsize>(n - done, epptr() - pptr());
+        memcpy(pptr(), s + done, k);
+        pbump(k);
+        done += k;
+    }
+    return done;
+}
+
+int writev_buf::sync()
+{
+    return write_out() ? 0 : -1;
+}
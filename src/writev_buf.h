@@ -0,0 +1,74 @@
+// align -- column alignment for streams -*- C++ -*-
+//
+// Copyright (c) 2013 Raphael 'kena' Poss
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef ALIGN_WRITEV_BUF_H
+#define ALIGN_WRITEV_BUF_H
+
+#include <vector>
+#include <chrono>
+#include <streambuf>
+#include <cstddef>
+#include <sys/uio.h>
+
+// Writes to a file descriptor in batches, each with a single
+// writev(). Characters are collected in an arena, except for spans
+// of at least min_ref characters that lie within a region known to
+// stay in place until the buffer is flushed, such as a mapped input
+// file: these are written from where they are, without a copy.
+class writev_buf : public std::streambuf
+{
+public:
+    explicit writev_buf(int fd, const char *region = NULL, size_t region_len = 0,
+                        size_t arena_size = 1 << 16);
+    ~writev_buf();
+
+    // Whether a write failed.
+    bool failed() const { return failed_; }
+
+    // Time spent in writev() so far.
+    std::chrono::steady_clock::duration write_time() const { return write_time_; }
+
+    enum { min_ref = 64 };  // shortest span written in place
+    enum { max_iov = 1024 }; // spans per writev()
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char *s, std::streamsize n);
+    virtual int sync();
+
+private:
+    writev_buf(const writev_buf&);
+    writev_buf& operator=(const writev_buf&);
+
+    void add(const char *s, size_t n);
+    void close_span();
+    bool write_out();
+
+    int                       fd_;
+    const char               *lo_, *hi_; // region of spans written in place
+    std::vector<char>         arena_;
+    char                     *span_;     // start of the arena span not in iov_
+    std::vector<struct iovec> iov_;
+    size_t                    ref_bytes_; // characters in iov_ outside the arena
+    bool                      failed_;
+    std::chrono::steady_clock::duration write_time_;
+};
+
+#endif